@@ -0,0 +1,944 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+/* Hardware-counter harness for the stages of the scan.
+ *
+ * Every stage runs over fixed, generated corpora while the cycles,
+ * instructions, branch misses and cache misses of the process are
+ * counted with perf_event_open(). The results are normalized to the
+ * corpus size, so they can be saved as a baseline and compared with
+ * later runs:
+ *
+ *     dumpfilter-perf -S baseline.txt
+ *     dumpfilter-perf -B baseline.txt -t branch_misses_per_kb=5
+ *
+ * The exit code is 1 if a metric regressed by more than its tolerance.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "../src/charbuffer.h"
+#include "../src/dumpfilter.h"
+#include "../src/memory.h"
+#include "../src/output.h"
+
+// The chunks handed to `charbuffer_contains_buffer()` and the output are
+// split at this size, like chunks limited with -m.
+#define PERF_CHUNK_SIZE (64 * 1024)
+
+// The number of bytes the scan stage feeds at once.
+#define PERF_READ_SIZE (1024 * 1024)
+
+// Chunks of the contains stage are built in batches of this size
+// before they are searched.
+#define PERF_BATCH_SIZE (4 * 1024 * 1024)
+
+// Printable runs shorter than this are not searched or written.
+#define PERF_MIN_RUN 16
+
+// The number of terms of the dictionary stage, which all start with
+// the same gram.
+#define PERF_DICT_TERMS 100000
+
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_CACHE_MISSES,
+    COUNTER_TASK_CLOCK,
+    COUNTER_COUNT
+};
+
+static const struct {
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+} counterInfo[COUNTER_COUNT] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"cache-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"task-clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK}
+};
+
+/**
+ * The counters of the process, -1 for those that are not available
+ * (e.g. in virtual machines or with a high `perf_event_paranoid`).
+ */
+struct counters {
+    int fds[COUNTER_COUNT];
+};
+
+/**
+ * The counted values of one run of a stage over *bytes* bytes.
+ */
+struct sample {
+    uint64_t values[COUNTER_COUNT];
+    uint64_t bytes;
+};
+
+/**
+ * The metrics that are reported and compared. They are normalized to
+ * the number of bytes, *counter* is the counter they are derived from.
+ * For most of them, lower values are better.
+ */
+struct metric {
+    const char* name;
+    int counter;
+    bool higherIsBetter;
+    double tolerance;
+};
+
+static struct metric metrics[] = {
+    {"cycles_per_kb", COUNTER_CYCLES, false, 5.0},
+    {"instructions_per_kb", COUNTER_INSTRUCTIONS, false, 2.0},
+    {"branch_misses_per_kb", COUNTER_BRANCH_MISSES, false, 10.0},
+    {"cache_misses_per_kb", COUNTER_CACHE_MISSES, false, 20.0},
+    {"bytes_per_cycle", COUNTER_CYCLES, true, 5.0},
+    {"ns_per_kb", COUNTER_TASK_CLOCK, false, 10.0}
+};
+
+#define METRIC_COUNT (sizeof(metrics) / sizeof(metrics[0]))
+
+/**
+ * A generated corpus and the printable runs in it.
+ */
+struct corpus {
+    const char* name;
+    char* data;
+    size_t size;
+
+    uint64_t* runs;
+    size_t runCount;
+};
+
+typedef bool (*stage_fn)(struct corpus* corpus, struct counters* counters,
+                         struct sample* sample);
+
+struct stage {
+    const char* name;
+    stage_fn fn;
+};
+
+/**
+ * A line of a baseline file.
+ */
+struct baseline_entry {
+    char stage[32];
+    char corpus[32];
+    char metric[32];
+    double value;
+};
+
+static struct {
+    size_t corpusSize;
+    int repetitions;
+    size_t bufSize;
+    int outFormat;
+    int threads;
+    int pages;
+    const char* baselinePath;
+    const char* savePath;
+    const char* corpusPath;
+} args;
+
+static dumpfilter_options_t options;
+static dumpfilter_query_t* query = NULL;
+static dumpfilter_query_t* dictQuery = NULL;
+
+static const char* terms[] = {"password", "secret", "BEGIN RSA", "foo@example.com"};
+
+#define TERM_COUNT (sizeof(terms) / sizeof(terms[0]))
+
+// Keeps the compiler from removing the loops of the stages.
+static volatile uint64_t sink;
+
+/**
+ * Open all available counters, disabled. They count the threads the
+ * process starts while they are enabled as well.
+ */
+static void counters_open(struct counters* counters) {
+    int i;
+    for (i=0; i < COUNTER_COUNT; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counterInfo[i].type;
+        attr.config = counterInfo[i].config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        counters->fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+}
+
+static void counters_close(struct counters* counters) {
+    int i;
+    for (i=0; i < COUNTER_COUNT; i++) {
+        if (counters->fds[i] >= 0) {
+            close(counters->fds[i]);
+        }
+    }
+}
+
+static void counters_control(struct counters* counters, unsigned long request) {
+    int i;
+    for (i=0; i < COUNTER_COUNT; i++) {
+        if (counters->fds[i] >= 0) {
+            ioctl(counters->fds[i], request, 0);
+        }
+    }
+}
+
+static void counters_reset(struct counters* counters) {
+    counters_control(counters, PERF_EVENT_IOC_RESET);
+}
+
+static void counters_enable(struct counters* counters) {
+    counters_control(counters, PERF_EVENT_IOC_ENABLE);
+}
+
+static void counters_disable(struct counters* counters) {
+    counters_control(counters, PERF_EVENT_IOC_DISABLE);
+}
+
+static void counters_read(struct counters* counters, struct sample* sample) {
+    int i;
+    for (i=0; i < COUNTER_COUNT; i++) {
+        uint64_t value = 0;
+        if (counters->fds[i] < 0 ||
+                read(counters->fds[i], &value, sizeof(value)) != sizeof(value)) {
+            value = 0;
+        }
+        sample->values[i] = value;
+    }
+}
+
+/**
+ * Compute metric *index* of *sample*. Returns false if its counter is
+ * not available.
+ */
+static bool metric_value(const struct sample* sample, size_t index, double* value) {
+    const struct metric* metric = &metrics[index];
+    double count = sample->values[metric->counter];
+    if (count == 0 || sample->bytes == 0) {
+        return false;
+    }
+    if (metric->higherIsBetter) {
+        *value = sample->bytes / count;
+    }
+    else {
+        *value = count * 1024.0 / sample->bytes;
+    }
+    return true;
+}
+
+/**
+ * A small, fast generator, so the corpora are the same on every
+ * machine and in every run.
+ */
+static uint64_t random_next(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+/**
+ * Fill *size* bytes with words, spaces and line breaks. Some of the
+ * words are the search terms.
+ */
+static void fill_text(char* data, size_t size, uint64_t* state) {
+    static const char* words[] = {
+        "the", "memory", "of", "process", "user", "name", "value", "id",
+        "http://", "GET", "/index.html", "0x7fff", "error", "session",
+        "password", "secret", "token", "config", "data", "file"
+    };
+    size_t filled = 0;
+    while (filled < size) {
+        const char* word = words[random_next(state) % (sizeof(words) / sizeof(words[0]))];
+        size_t length = strlen(word);
+        if (length > size - filled) {
+            length = size - filled;
+        }
+        memcpy(data + filled, word, length);
+        filled += length;
+        if (filled < size) {
+            data[filled++] = random_next(state) % 16 == 0 ? '\n' : ' ';
+        }
+    }
+}
+
+/**
+ * Generate the corpus with *name*: "text", "binary" or "mixed", which
+ * alternates text with random and zeroed binary data like a memory
+ * dump.
+ */
+static bool corpus_generate(struct corpus* corpus, const char* name, size_t size) {
+    corpus->name = name;
+    corpus->size = size;
+    corpus->data = allocate_pages(size);
+    if (!corpus->data) {
+        return false;
+    }
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    if (strcmp(name, "text") == 0) {
+        fill_text(corpus->data, size, &state);
+    }
+    else if (strcmp(name, "binary") == 0) {
+        size_t i;
+        for (i=0; i < size; i++) {
+            corpus->data[i] = random_next(&state) >> 56;
+        }
+    }
+    else {
+        size_t filled = 0;
+        while (filled < size) {
+            uint64_t kind = random_next(&state) % 4;
+            size_t length = kind == 0 ? 16 + random_next(&state) % 2048 :
+                                        1 + random_next(&state) % 4096;
+            if (length > size - filled) {
+                length = size - filled;
+            }
+            if (kind == 0) {
+                fill_text(corpus->data + filled, length, &state);
+            }
+            else if (kind == 1) {
+                size_t i;
+                for (i=0; i < length; i++) {
+                    corpus->data[filled + i] = random_next(&state) >> 56;
+                }
+            }
+            // Zeroed pages are left as they are.
+            filled += length;
+        }
+    }
+    return true;
+}
+
+/**
+ * Read the corpus from the file at *path*.
+ */
+static bool corpus_load(struct corpus* corpus, const char* path) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    bool result = fseek(fp, 0, SEEK_END) == 0;
+    long size = result ? ftell(fp) : -1;
+    if (size <= 0 || fseek(fp, 0, SEEK_SET) != 0) {
+        fclose(fp);
+        return false;
+    }
+    corpus->name = "file";
+    corpus->size = size;
+    corpus->data = allocate_pages(size);
+    result = corpus->data && fread(corpus->data, 1, size, fp) == (size_t) size;
+    fclose(fp);
+    return result;
+}
+
+/**
+ * Find the printable runs of the corpus, split at `PERF_CHUNK_SIZE`.
+ * Every run is stored as its offset and length.
+ */
+static bool corpus_runs(struct corpus* corpus) {
+    size_t capacity = 1024;
+    corpus->runs = allocate(sizeof(uint64_t) * 2 * capacity);
+    corpus->runCount = 0;
+    size_t start = 0;
+    size_t i;
+    for (i=0; i <= corpus->size && corpus->runs; i++) {
+        bool printable = i < corpus->size &&
+                dumpfilter_is_printable(&options, corpus->data[i]);
+        if (printable && i - start < PERF_CHUNK_SIZE) {
+            continue;
+        }
+        if (i > start) {
+            if (corpus->runCount == capacity) {
+                capacity *= 2;
+                uint64_t* runs = reallocate(corpus->runs, sizeof(uint64_t) * 2 * capacity);
+                if (!runs) {
+                    break;
+                }
+                corpus->runs = runs;
+            }
+            corpus->runs[corpus->runCount * 2] = start;
+            corpus->runs[corpus->runCount * 2 + 1] = i - start;
+            corpus->runCount++;
+        }
+        start = printable ? i : i + 1;
+    }
+    return i > corpus->size;
+}
+
+static void corpus_free(struct corpus* corpus) {
+    deallocate_pages(corpus->data, corpus->size);
+    if (corpus->runs) {
+        deallocate(corpus->runs);
+    }
+}
+
+/**
+ * Classify every byte of the corpus.
+ */
+static bool stage_classify(struct corpus* corpus, struct counters* counters,
+                           struct sample* sample) {
+    uint64_t count = 0;
+    size_t i;
+    counters_enable(counters);
+    for (i=0; i < corpus->size; i++) {
+        count += dumpfilter_is_printable(&options, corpus->data[i]);
+    }
+    counters_disable(counters);
+    sink = count;
+    sample->bytes = corpus->size;
+    return true;
+}
+
+/**
+ * Append the printable runs to a charbuffer byte by byte, like the
+ * scanner does, and flush it after every run.
+ */
+static bool stage_append(struct corpus* corpus, struct counters* counters,
+                         struct sample* sample) {
+    charbuffer_t* buffer = charbuffer_alloc(args.bufSize);
+    if (!buffer) {
+        return false;
+    }
+    bool result = true;
+    size_t i;
+    counters_enable(counters);
+    for (i=0; i < corpus->runCount && result; i++) {
+        const char* data = corpus->data + corpus->runs[i * 2];
+        uint64_t length = corpus->runs[i * 2 + 1];
+        charbuffer_t* last = buffer;
+        uint64_t j;
+        for (j=0; j < length && last; j++) {
+            last = charbuffer_append_char(last, data[j]);
+        }
+        result = last != NULL;
+        charbuffer_flush(buffer);
+    }
+    counters_disable(counters);
+    charbuffer_free(buffer);
+    sample->bytes = corpus->size;
+    return result;
+}
+
+/**
+ * Search the terms in the printable runs of the corpus, which are
+ * copied into charbuffers in batches outside the measurement.
+ */
+static bool stage_contains(struct corpus* corpus, struct counters* counters,
+                           struct sample* sample) {
+    charbuffer_t** chunks = allocate(sizeof(charbuffer_t*) * (PERF_BATCH_SIZE / PERF_MIN_RUN + 1));
+    if (!chunks) {
+        return false;
+    }
+    bool result = true;
+    uint64_t found = 0;
+    size_t next = 0;
+    while (next < corpus->runCount && result) {
+        size_t count = 0;
+        size_t batch = 0;
+        for (; next < corpus->runCount && batch < PERF_BATCH_SIZE && result; next++) {
+            uint64_t length = corpus->runs[next * 2 + 1];
+            if (length < PERF_MIN_RUN) {
+                continue;
+            }
+            charbuffer_t* chunk = charbuffer_alloc(args.bufSize);
+            result = chunk && charbuffer_append_buffer(
+                    chunk, corpus->data + corpus->runs[next * 2], length);
+            if (chunk) {
+                chunks[count++] = chunk;
+            }
+            batch += length;
+        }
+
+        size_t i, j;
+        counters_enable(counters);
+        for (i=0; i < count && result; i++) {
+            for (j=0; j < TERM_COUNT; j++) {
+                found += charbuffer_contains_buffer(chunks[i], terms[j],
+                                                    strlen(terms[j]), NULL, NULL);
+            }
+        }
+        counters_disable(counters);
+        for (i=0; i < count; i++) {
+            charbuffer_free(chunks[i]);
+        }
+    }
+    deallocate(chunks);
+    sink = found;
+    sample->bytes = corpus->size;
+    return result;
+}
+
+/**
+ * Write the printable runs to /dev/null through an output, including
+ * the compression threads with -Z.
+ */
+static bool stage_output(struct corpus* corpus, struct counters* counters,
+                         struct sample* sample) {
+    counters_enable(counters);
+    output_t* output = output_open("/dev/null", args.outFormat, 0, args.threads);
+    bool result = output != NULL;
+    size_t i;
+    for (i=0; i < corpus->runCount && result; i++) {
+        uint64_t length = corpus->runs[i * 2 + 1];
+        if (length >= PERF_MIN_RUN) {
+            result = output_printf(output, "%llu\n", (unsigned long long) corpus->runs[i * 2]) &&
+                    output_write(output, corpus->data + corpus->runs[i * 2], length) &&
+                    output_write(output, "\n", 1);
+        }
+    }
+    if (output && !output_close(output)) {
+        result = false;
+    }
+    counters_disable(counters);
+    sample->bytes = corpus->size;
+    return result;
+}
+
+static bool scan_matched(void* user, const dumpfilter_match_t* match) {
+    (*(uint64_t*) user)++;
+    (void) match;
+    return true;
+}
+
+/**
+ * Run the whole scanner over the corpus with *scanQuery*.
+ */
+static bool scan_corpus(struct corpus* corpus, struct counters* counters,
+                        struct sample* sample, dumpfilter_query_t* scanQuery) {
+    uint64_t matches = 0;
+    counters_enable(counters);
+    dumpfilter_t* scanner = dumpfilter_alloc(scanQuery, &options, scan_matched, &matches);
+    bool result = scanner != NULL;
+    size_t offset;
+    for (offset=0; offset < corpus->size && result; offset += PERF_READ_SIZE) {
+        size_t size = corpus->size - offset;
+        if (size > PERF_READ_SIZE) {
+            size = PERF_READ_SIZE;
+        }
+        result = dumpfilter_feed(scanner, corpus->data + offset, size);
+    }
+    if (result) {
+        result = dumpfilter_finish(scanner);
+    }
+    if (scanner) {
+        dumpfilter_free(scanner);
+    }
+    counters_disable(counters);
+    sink = matches;
+    sample->bytes = corpus->size;
+    return result;
+}
+
+static bool stage_scan(struct corpus* corpus, struct counters* counters,
+                       struct sample* sample) {
+    return scan_corpus(corpus, counters, sample, query);
+}
+
+/**
+ * Run the scanner with a large dictionary of URLs, whose first gram
+ * "http" is frequent in the text.
+ */
+static bool stage_dictionary(struct corpus* corpus, struct counters* counters,
+                             struct sample* sample) {
+    return scan_corpus(corpus, counters, sample, dictQuery);
+}
+
+static const struct stage stages[] = {
+    {"classify", stage_classify},
+    {"append", stage_append},
+    {"contains", stage_contains},
+    {"output", stage_output},
+    {"scan", stage_scan},
+    {"dict", stage_dictionary}
+};
+
+#define STAGE_COUNT (sizeof(stages) / sizeof(stages[0]))
+
+/**
+ * Read the baseline file. Returns the number of entries or -1 on
+ * failure.
+ */
+static int baseline_load(const char* path, struct baseline_entry** outEntries) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    size_t capacity = 64;
+    int count = 0;
+    struct baseline_entry* entries = allocate(sizeof(struct baseline_entry) * capacity);
+    char line[256];
+    while (entries && fgets(line, sizeof(line), fp)) {
+        struct baseline_entry entry;
+        if (line[0] == '#' || sscanf(line, "%31s %31s %31s %lf", entry.stage,
+                                     entry.corpus, entry.metric, &entry.value) != 4) {
+            continue;
+        }
+        if ((size_t) count == capacity) {
+            capacity *= 2;
+            struct baseline_entry* larger = reallocate(
+                    entries, sizeof(struct baseline_entry) * capacity);
+            if (!larger) {
+                deallocate(entries);
+                entries = NULL;
+                break;
+            }
+            entries = larger;
+        }
+        entries[count++] = entry;
+    }
+    fclose(fp);
+    *outEntries = entries;
+    return entries ? count : -1;
+}
+
+static const struct baseline_entry* baseline_find(
+        const struct baseline_entry* entries, int count, const char* stage,
+        const char* corpus, const char* metric) {
+    int i;
+    for (i=0; i < count; i++) {
+        if (strcmp(entries[i].stage, stage) == 0 &&
+                strcmp(entries[i].corpus, corpus) == 0 &&
+                strcmp(entries[i].metric, metric) == 0) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Set the tolerance of the metric in *spec* ("name=percent"), or of all
+ * metrics if only a percentage is passed.
+ */
+static bool set_tolerance(const char* spec) {
+    const char* value = strchr(spec, '=');
+    size_t i;
+    if (!value) {
+        double percent = atof(spec);
+        for (i=0; i < METRIC_COUNT; i++) {
+            metrics[i].tolerance = percent;
+        }
+        return percent > 0;
+    }
+    for (i=0; i < METRIC_COUNT; i++) {
+        if (strlen(metrics[i].name) == (size_t) (value - spec) &&
+                strncmp(metrics[i].name, spec, value - spec) == 0) {
+            metrics[i].tolerance = atof(value + 1);
+            return metrics[i].tolerance > 0;
+        }
+    }
+    return false;
+}
+
+/**
+ * Parse a size with an optional K, M or G suffix (powers of 1024).
+ * Returns 0 if it is invalid.
+ */
+static uint64_t parse_size(const char* string) {
+    char* endptr = NULL;
+    uint64_t value = strtoull(string, &endptr, 10);
+    uint64_t mul = 1;
+    switch (*endptr) {
+        case 'K':
+            mul = 1024;
+            break;
+        case 'M':
+            mul = 1024L * 1024L;
+            break;
+        case 'G':
+            mul = 1024L * 1024L * 1024L;
+            break;
+    }
+    if (mul != 1) {
+        value *= mul;
+        endptr++;
+    }
+    return *endptr ? 0 : value;
+}
+
+static int usage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf(
+        "Runs the stages of the scan over generated corpora and reports\n"
+        "hardware counters per KB of input.\n"
+        "Options:\n"
+        "  -s <bytes>           The size of the generated corpora. Default\n"
+        "                       is 64M.\n"
+        "  -c <filename>        Use this file as an additional corpus.\n"
+        "  -r <count>           Run every stage this many times and keep the\n"
+        "                       fastest run. Default is 3.\n"
+        "  -b <bytes>           The charbuffer block size. Default is 1024.\n"
+        "  -Z <format>          The format of the output stage: none, gzip or\n"
+        "                       zstd. Default is none.\n"
+        "  -j <threads>         The compression threads of the output stage.\n"
+        "  -P <pages>           The pages of the corpora, chunk and output\n"
+        "                       buffers: normal, transparent (huge pages) or\n"
+        "                       hugetlb (reserved huge pages). Default is\n"
+        "                       normal.\n"
+        "  -S <filename>        Save the results as a baseline.\n"
+        "  -B <filename>        Compare the results with this baseline. The\n"
+        "                       exit code is 1 if a metric regressed.\n"
+        "  -t [<metric>=]<percent>\n"
+        "                       The tolerance of a metric, or of all metrics.\n"
+        "                       Can be passed multiple times.\n"
+        "\n"
+        "Metrics (default tolerance):\n"
+    );
+    size_t i;
+    for (i=0; i < METRIC_COUNT; i++) {
+        printf("  %-22s %.0f%%\n", metrics[i].name, metrics[i].tolerance);
+    }
+    return EINVAL;
+}
+
+int main(int argc, char** argv) {
+    args.corpusSize = 64 * 1024 * 1024;
+    args.repetitions = 3;
+    args.bufSize = 1024;
+    args.outFormat = OUTPUT_PLAIN;
+    args.threads = 1;
+    args.pages = MEMORY_PAGES_NORMAL;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:c:r:b:Z:j:P:S:B:t:h")) != -1) {
+        switch (c) {
+        case 's':
+            args.corpusSize = parse_size(optarg);
+            break;
+        case 'c':
+            args.corpusPath = optarg;
+            break;
+        case 'r':
+            args.repetitions = atoi(optarg);
+            break;
+        case 'b':
+            args.bufSize = parse_size(optarg);
+            break;
+        case 'Z':
+            args.outFormat = output_parse(optarg);
+            if (args.outFormat < 0 || !output_supported(args.outFormat)) {
+                printf("-Z: unsupported format %s.\n\n", optarg);
+                return usage(argv[0]);
+            }
+            break;
+        case 'j':
+            args.threads = atoi(optarg);
+            break;
+        case 'P':
+            args.pages = memory_parse_pages(optarg);
+            if (args.pages < 0) {
+                printf("-P: unknown kind of pages %s.\n\n", optarg);
+                return usage(argv[0]);
+            }
+            break;
+        case 'S':
+            args.savePath = optarg;
+            break;
+        case 'B':
+            args.baselinePath = optarg;
+            break;
+        case 't':
+            if (!set_tolerance(optarg)) {
+                printf("-t: invalid tolerance %s.\n\n", optarg);
+                return usage(argv[0]);
+            }
+            break;
+        case 'h':
+        default:
+            return usage(argv[0]);
+        }
+    }
+    if (args.corpusSize == 0 || args.repetitions < 1 || args.bufSize < 128 ||
+            args.threads < 1) {
+        return usage(argv[0]);
+    }
+    memory_set_pages(args.pages);
+
+    struct counters counters;
+    counters_open(&counters);
+    int i;
+    for (i=0; i < COUNTER_COUNT; i++) {
+        if (counters.fds[i] < 0) {
+            fprintf(stderr, "Counter %s is not available: %s\n",
+                    counterInfo[i].name, strerror(errno));
+        }
+    }
+
+    dumpfilter_options_init(&options);
+    options.bufSize = args.bufSize;
+    query = dumpfilter_query_alloc();
+    size_t t;
+    for (t=0; t < TERM_COUNT && query; t++) {
+        if (!dumpfilter_query_add(query, terms[t], strlen(terms[t]))) {
+            dumpfilter_query_free(query);
+            query = NULL;
+        }
+    }
+    if (!query || !dumpfilter_query_compile(query)) {
+        fprintf(stderr, "Could not compile the search terms.\n");
+        return ENOMEM;
+    }
+    dictQuery = dumpfilter_query_alloc();
+    for (t=0; t < PERF_DICT_TERMS && dictQuery; t++) {
+        char term[64];
+        int length = snprintf(term, sizeof(term), "http://www.host%05u.example.com/",
+                              (unsigned int) t);
+        if (!dumpfilter_query_add(dictQuery, term, length)) {
+            dumpfilter_query_free(dictQuery);
+            dictQuery = NULL;
+        }
+    }
+    if (!dictQuery || !dumpfilter_query_compile(dictQuery)) {
+        fprintf(stderr, "Could not compile the dictionary.\n");
+        return ENOMEM;
+    }
+
+    static const char* corpusNames[] = {"text", "binary", "mixed"};
+    struct corpus corpora[4];
+    size_t corpusCount = 0;
+    memset(corpora, 0, sizeof(corpora));
+    for (t=0; t < 3; t++) {
+        if (!corpus_generate(&corpora[corpusCount++], corpusNames[t], args.corpusSize)) {
+            fprintf(stderr, "Could not generate the corpora.\n");
+            return ENOMEM;
+        }
+    }
+    if (args.corpusPath && !corpus_load(&corpora[corpusCount++], args.corpusPath)) {
+        fprintf(stderr, "Could not read corpus %s.\n", args.corpusPath);
+        return ENOENT;
+    }
+    for (t=0; t < corpusCount; t++) {
+        if (!corpus_runs(&corpora[t])) {
+            fprintf(stderr, "Could not find the printable runs.\n");
+            return ENOMEM;
+        }
+    }
+
+    struct baseline_entry* baseline = NULL;
+    int baselineCount = 0;
+    if (args.baselinePath) {
+        baselineCount = baseline_load(args.baselinePath, &baseline);
+        if (baselineCount < 0) {
+            fprintf(stderr, "Could not read baseline %s.\n", args.baselinePath);
+            return ENOENT;
+        }
+    }
+    FILE* save = NULL;
+    if (args.savePath) {
+        save = fopen(args.savePath, "w");
+        if (!save) {
+            fprintf(stderr, "Could not write baseline %s.\n", args.savePath);
+            return ENOENT;
+        }
+        fprintf(save, "# stage corpus metric value\n");
+    }
+
+    int result = 0;
+    size_t s, m;
+    printf("%-9s %-7s %-21s %14s %14s %9s\n", "stage", "corpus", "metric",
+           "value", "baseline", "change");
+    for (s=0; s < STAGE_COUNT && result != EIO; s++) {
+        for (t=0; t < corpusCount && result != EIO; t++) {
+            // The run with the fewest cycles (or the shortest time) has
+            // the least noise from the rest of the system.
+            struct sample best;
+            memset(&best, 0, sizeof(best));
+            int r;
+            for (r=0; r < args.repetitions; r++) {
+                struct sample sample;
+                memset(&sample, 0, sizeof(sample));
+                counters_reset(&counters);
+                if (!stages[s].fn(&corpora[t], &counters, &sample)) {
+                    fprintf(stderr, "Stage %s failed.\n", stages[s].name);
+                    result = EIO;
+                    break;
+                }
+                counters_read(&counters, &sample);
+                int key = sample.values[COUNTER_CYCLES] ? COUNTER_CYCLES : COUNTER_TASK_CLOCK;
+                if (r == 0 || sample.values[key] < best.values[key]) {
+                    best = sample;
+                }
+            }
+
+            for (m=0; m < METRIC_COUNT && result != EIO; m++) {
+                double value;
+                if (!metric_value(&best, m, &value)) {
+                    continue;
+                }
+                if (save) {
+                    fprintf(save, "%s %s %s %.6f\n", stages[s].name,
+                            corpora[t].name, metrics[m].name, value);
+                }
+                const struct baseline_entry* entry = baseline_find(
+                        baseline, baselineCount, stages[s].name,
+                        corpora[t].name, metrics[m].name);
+                printf("%-9s %-7s %-21s %14.4f", stages[s].name,
+                       corpora[t].name, metrics[m].name, value);
+                if (!entry || entry->value == 0) {
+                    printf("\n");
+                    continue;
+                }
+                double change = (value - entry->value) / entry->value * 100.0;
+                double worse = metrics[m].higherIsBetter ? -change : change;
+                bool regressed = worse > metrics[m].tolerance;
+                printf(" %14.4f %+8.1f%%%s\n", entry->value, change,
+                       regressed ? "  REGRESSION" : "");
+                if (regressed) {
+                    result = 1;
+                }
+            }
+        }
+    }
+
+    if (save && fclose(save) != 0) {
+        fprintf(stderr, "Could not write baseline %s.\n", args.savePath);
+        result = EIO;
+    }
+    if (baseline) {
+        deallocate(baseline);
+    }
+    for (t=0; t < corpusCount; t++) {
+        corpus_free(&corpora[t]);
+    }
+    dumpfilter_query_free(query);
+    dumpfilter_query_free(dictQuery);
+    counters_close(&counters);
+    memory_info(stderr);
+    return result;
+}
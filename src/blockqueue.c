@@ -0,0 +1,180 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "blockqueue.h"
+
+#include <string.h>
+
+struct blockqueue_slot {
+    blockqueue_block_t block;
+    bool ready;
+};
+
+struct blockqueue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    struct blockqueue_slot* slots;
+    size_t depth;
+
+    // Sequence numbers of the next block to claim and to consume.
+    uint64_t claimSeq;
+    uint64_t readSeq;
+
+    bool finished;
+    bool error;
+    bool closed;
+};
+
+blockqueue_t* blockqueue_alloc(size_t depth, size_t capacity) {
+    blockqueue_t* queue = allocate(sizeof(blockqueue_t));
+    if (!queue) {
+        return NULL;
+    }
+    memset(queue, 0, sizeof(blockqueue_t));
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+
+    queue->slots = allocate(sizeof(struct blockqueue_slot) * depth);
+    if (!queue->slots) {
+        pthread_mutex_destroy(&queue->lock);
+        pthread_cond_destroy(&queue->changed);
+        deallocate(queue);
+        return NULL;
+    }
+    memset(queue->slots, 0, sizeof(struct blockqueue_slot) * depth);
+    queue->depth = depth;
+
+    size_t i;
+    for (i=0; i < depth; i++) {
+        queue->slots[i].block.data = allocate_pages(capacity);
+        if (!queue->slots[i].block.data) {
+            blockqueue_free(queue);
+            return NULL;
+        }
+        queue->slots[i].block.capacity = capacity;
+    }
+    return queue;
+}
+
+void blockqueue_free(blockqueue_t* queue) {
+    if (!queue) {
+        return;
+    }
+    size_t i;
+    for (i=0; i < queue->depth; i++) {
+        blockqueue_block_t* block = &queue->slots[i].block;
+        deallocate_pages(block->data, block->capacity);
+    }
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->changed);
+    deallocate(queue->slots);
+    deallocate(queue);
+}
+
+bool blockqueue_reserve(blockqueue_block_t* block, size_t capacity) {
+    if (capacity <= block->capacity) {
+        return true;
+    }
+    char* data = allocate_pages(capacity);
+    if (!data) {
+        return false;
+    }
+    memcpy(data, block->data, block->size);
+    deallocate_pages(block->data, block->capacity);
+    block->data = data;
+    block->capacity = capacity;
+    return true;
+}
+
+blockqueue_block_t* blockqueue_claim(blockqueue_t* queue, uint64_t* outSeq) {
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->closed && queue->claimSeq >= queue->readSeq + queue->depth) {
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    blockqueue_block_t* block = NULL;
+    if (!queue->closed) {
+        struct blockqueue_slot* slot =
+                &queue->slots[queue->claimSeq % queue->depth];
+        slot->ready = false;
+        slot->block.size = 0;
+        block = &slot->block;
+        *outSeq = queue->claimSeq++;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return block;
+}
+
+void blockqueue_submit(blockqueue_t* queue, uint64_t seq) {
+    pthread_mutex_lock(&queue->lock);
+    queue->slots[seq % queue->depth].ready = true;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void blockqueue_finish(blockqueue_t* queue, bool error) {
+    pthread_mutex_lock(&queue->lock);
+    queue->finished = true;
+    queue->error |= error;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+blockqueue_block_t* blockqueue_next(blockqueue_t* queue) {
+    pthread_mutex_lock(&queue->lock);
+    blockqueue_block_t* block = NULL;
+    for (;;) {
+        struct blockqueue_slot* slot =
+                &queue->slots[queue->readSeq % queue->depth];
+        if (queue->readSeq < queue->claimSeq && slot->ready) {
+            block = &slot->block;
+            break;
+        }
+        // Every claimed block is submitted, so the blocks before an
+        // error are delivered as well.
+        if ((queue->finished || queue->error) && queue->readSeq >= queue->claimSeq) {
+            break;
+        }
+        pthread_cond_wait(&queue->changed, &queue->lock);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return block;
+}
+
+void blockqueue_release(blockqueue_t* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->slots[queue->readSeq % queue->depth].ready = false;
+    queue->readSeq++;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+void blockqueue_close(blockqueue_t* queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->closed = true;
+    pthread_cond_broadcast(&queue->changed);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+bool blockqueue_failed(blockqueue_t* queue) {
+    pthread_mutex_lock(&queue->lock);
+    bool error = queue->error;
+    pthread_mutex_unlock(&queue->lock);
+    return error;
+}
@@ -0,0 +1,110 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef BLOCKQUEUE_H__
+#define BLOCKQUEUE_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <pthread.h>
+
+    #include "memory.h"
+
+    /**
+     * A bounded queue of data blocks that connects producer threads
+     * to a single consumer. Producers claim blocks in sequence, but may
+     * fill and submit them in any order; the consumer always receives
+     * them in the order they were claimed. At most *depth* blocks are
+     * in flight, producers wait when the consumer falls behind.
+     */
+    struct blockqueue;
+
+    typedef struct blockqueue blockqueue_t;
+
+    struct blockqueue_block {
+        char* data;
+        size_t size;
+        size_t capacity;
+    };
+
+    typedef struct blockqueue_block blockqueue_block_t;
+
+    /**
+     * Allocate a queue with *depth* blocks of *capacity* bytes each.
+     * Returns NULL on failure.
+     */
+    blockqueue_t* blockqueue_alloc(size_t depth, size_t capacity);
+
+    /**
+     * Free the queue and its blocks. No thread may use the queue
+     * anymore.
+     */
+    void blockqueue_free(blockqueue_t* queue);
+
+    /**
+     * Claim the next block for writing. Waits until a block is free.
+     * The sequence number of the block is assigned to *outSeq*. Returns
+     * NULL if the queue was closed by the consumer.
+     */
+    blockqueue_block_t* blockqueue_claim(blockqueue_t* queue, uint64_t* outSeq);
+
+    /**
+     * Enlarge a claimed block so it can hold at least *capacity* bytes.
+     * The contents are preserved. Returns false on a memory error.
+     */
+    bool blockqueue_reserve(blockqueue_block_t* block, size_t capacity);
+
+    /**
+     * Hand a claimed and filled block over to the consumer.
+     */
+    void blockqueue_submit(blockqueue_t* queue, uint64_t seq);
+
+    /**
+     * Tell the consumer that no more blocks will be claimed. If *error*
+     * is true, the consumer will stop with an error.
+     */
+    void blockqueue_finish(blockqueue_t* queue, bool error);
+
+    /**
+     * Wait for the next block in sequence. Returns NULL when all blocks
+     * have been consumed after `blockqueue_finish()`. If it reported an
+     * error, the blocks claimed before are still returned first (see
+     * `blockqueue_failed()`). The block must be passed back with
+     * `blockqueue_release()` before the next block can be retrieved.
+     */
+    blockqueue_block_t* blockqueue_next(blockqueue_t* queue);
+
+    /**
+     * Release the block returned by `blockqueue_next()`.
+     */
+    void blockqueue_release(blockqueue_t* queue);
+
+    /**
+     * Stop the producers, pending and future claims return NULL.
+     */
+    void blockqueue_close(blockqueue_t* queue);
+
+    /**
+     * Returns true if a producer finished the queue with an error.
+     */
+    bool blockqueue_failed(blockqueue_t* queue);
+
+#endif /* BLOCKQUEUE_H__ */
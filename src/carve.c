@@ -0,0 +1,638 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "carve.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+static const struct {
+    const char* name;
+    const char* extension;
+    const char* magic;
+    size_t length;
+} signatures[CARVE_TYPE_COUNT] = {
+    {"pdf", "pdf", "%PDF-", 5},
+    {"zip", "zip", "PK\x03\x04", 4},
+    {"jpeg", "jpg", "\xFF\xD8\xFF", 3},
+    {"sqlite", "sqlite", "SQLite format 3", 16}
+};
+
+const char* carve_type_name(int type) {
+    if (type < 0 || type >= CARVE_TYPE_COUNT) {
+        return "unknown";
+    }
+    return signatures[type].name;
+}
+
+carve_t* carve_alloc(const char* directory, uint64_t extractSize,
+                     carve_fn callback, void* user) {
+    carve_t* carve = allocate(sizeof(carve_t));
+    if (!carve) {
+        return NULL;
+    }
+    memset(carve, 0, sizeof(carve_t));
+    carve->callback = callback;
+    carve->user = user;
+    carve->directory = directory;
+    carve->extractSize = extractSize ? extractSize : CARVE_EXTRACT_SIZE;
+
+    // Every signature is at least two bytes long, so its first two
+    // bytes select the candidates at a position.
+    int type;
+    for (type=0; type < CARVE_TYPE_COUNT; type++) {
+        const unsigned char* magic = (const unsigned char*) signatures[type].magic;
+        carve->prefixes[magic[0] | (magic[1] << 8)] |= 1 << type;
+    }
+    return carve;
+}
+
+static void carve_close(carve_t* carve, size_t index) {
+    struct carve_extract* extract = &carve->extracts[index];
+    if (fclose(extract->fp) != 0) {
+        carve->failed = true;
+    }
+    carve->extracts[index] = carve->extracts[--carve->extractCount];
+}
+
+void carve_free(carve_t* carve) {
+    if (carve) {
+        while (carve->extractCount > 0) {
+            carve_close(carve, 0);
+        }
+        deallocate(carve);
+    }
+}
+
+void carve_reset(carve_t* carve, uint64_t position, const char* prefix) {
+    while (carve->extractCount > 0) {
+        carve_close(carve, 0);
+    }
+    carve->position = position;
+    carve->historyLength = 0;
+    carve->zipOpen = false;
+    carve->jpegOpen = false;
+    carve->jpegStart = 0;
+    carve->jpegEnd = 0;
+    snprintf(carve->prefix, sizeof(carve->prefix), "%s", prefix ? prefix : "");
+}
+
+static uint32_t read_be(const unsigned char* bytes, size_t count) {
+    uint32_t value = 0;
+    size_t i;
+    for (i=0; i < count; i++) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+static uint32_t read_le(const unsigned char* bytes, size_t count) {
+    uint32_t value = 0;
+    while (count-- > 0) {
+        value = (value << 8) | bytes[count];
+    }
+    return value;
+}
+
+/**
+ * Check whether the *available* bytes start with a valid signature of
+ * *type*. The size of the file is assigned to *size* if the header
+ * contains it.
+ */
+static bool carve_validate(int type, const unsigned char* bytes, size_t available,
+                           uint64_t* size) {
+    size_t length = signatures[type].length;
+    if (available < length || memcmp(bytes, signatures[type].magic, length) != 0) {
+        return false;
+    }
+    *size = 0;
+    switch (type) {
+        case CARVE_PDF:
+            // The version follows, "%PDF-1.7".
+            return available > 5 && bytes[5] >= '1' && bytes[5] <= '2';
+        case CARVE_ZIP:
+            // The version needed to extract is small.
+            return available >= 6 && bytes[5] == 0 && bytes[4] <= 100;
+        case CARVE_JPEG:
+            // Another marker follows the start of the image.
+            return available > 3 && bytes[3] >= 0xC0 && bytes[3] != 0xD9 &&
+                    bytes[3] != 0xFF;
+        case CARVE_SQLITE:
+            if (available >= 32) {
+                uint64_t pageSize = read_be(bytes + 16, 2);
+                uint64_t pageCount = read_be(bytes + 28, 4);
+                if (pageSize == 1) {
+                    pageSize = 65536;
+                }
+                if (pageSize >= 512 && (pageSize & (pageSize - 1)) == 0) {
+                    *size = pageSize * pageCount;
+                }
+            }
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Write the next bytes of an extracted file. The file is closed when
+ * it is complete, which is why its *index* is required.
+ */
+static bool carve_write(carve_t* carve, size_t index, const unsigned char* data,
+                        size_t size) {
+    struct carve_extract* extract = &carve->extracts[index];
+    bool complete = false;
+    if (extract->type == CARVE_JPEG && extract->firstEnd == 0 && size > 0) {
+        // Remember the first marker FF D9, an image that can not be
+        // parsed ends with it.
+        size_t end = 0;
+        if (extract->lastFF && data[0] == 0xD9) {
+            end = 1;
+        }
+        else {
+            const unsigned char* marker = data;
+            while ((marker = memchr(marker, 0xFF, data + size - 1 - marker))) {
+                if (marker[1] == 0xD9) {
+                    end = marker - data + 2;
+                    break;
+                }
+                marker++;
+            }
+            extract->lastFF = data[size - 1] == 0xFF;
+        }
+        if (end != 0) {
+            extract->firstEnd = extract->start + extract->written + end;
+            if (extract->damaged) {
+                size = end;
+                complete = true;
+            }
+        }
+    }
+    if (size >= extract->remaining) {
+        size = extract->remaining;
+        complete = true;
+    }
+    if (size > 0 && fwrite(data, 1, size, extract->fp) != size) {
+        carve->failed = true;
+        complete = true;
+    }
+    extract->written += size;
+    extract->remaining -= size;
+    if (complete) {
+        carve_close(carve, index);
+    }
+    return !complete;
+}
+
+/**
+ * Start extracting the file at *offset*. The *pending* bytes of it that
+ * were fed before are written right away.
+ */
+static bool carve_extract(carve_t* carve, carve_hit_t* hit,
+                          const unsigned char* pending, size_t pendingLength) {
+    if (carve->extractCount == CARVE_MAX_EXTRACTS) {
+        return true;
+    }
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s%llu.%s", carve->directory, carve->prefix,
+             (unsigned long long) hit->offset, signatures[hit->type].extension);
+    FILE* fp = fopen(path, "wb");
+    if (!fp) {
+        return false;
+    }
+    struct carve_extract* extract = &carve->extracts[carve->extractCount++];
+    extract->fp = fp;
+    extract->type = hit->type;
+    extract->start = hit->offset;
+    extract->written = 0;
+    extract->firstEnd = 0;
+    extract->damaged = false;
+    extract->lastFF = false;
+    extract->remaining = carve->extractSize;
+    if (hit->size != 0 && hit->size < extract->remaining) {
+        extract->remaining = hit->size;
+    }
+    hit->extracted = true;
+    if (pendingLength > 0) {
+        carve_write(carve, carve->extractCount - 1, pending, pendingLength);
+    }
+    return true;
+}
+
+/**
+ * Track the ZIP archive that the local header at *offset* belongs to.
+ * Returns true if it is a member of the archive that is already open,
+ * otherwise it opens a new archive.
+ */
+static bool carve_zip_member(carve_t* carve, const unsigned char* bytes,
+                             size_t available, uint64_t offset) {
+    bool member = carve->zipOpen && offset <= carve->zipLimit;
+    if (!member) {
+        carve->zipOpen = true;
+        carve->zipStart = offset;
+        carve->zipDataEnd = offset;
+        carve->zipLimit = offset;
+    }
+
+    // The next member follows the data of this one, unless its size is
+    // only recorded in a data descriptor after the data (flag bit 3).
+    uint64_t dataEnd = offset;
+    uint64_t limit = offset + carve->extractSize;
+    if (available >= 30 && !(read_le(bytes + 6, 2) & 8) &&
+            read_le(bytes + 18, 4) != 0xFFFFFFFF) {
+        dataEnd = offset + 30 + read_le(bytes + 26, 2) + read_le(bytes + 28, 2) +
+                read_le(bytes + 18, 4);
+        limit = dataEnd;
+    }
+    if (dataEnd > carve->zipDataEnd) {
+        carve->zipDataEnd = dataEnd;
+    }
+    if (limit > carve->zipLimit) {
+        carve->zipLimit = limit;
+    }
+    return member;
+}
+
+/**
+ * End the extraction of the file of *type* at *start* at the absolute
+ * offset *end*, if it is still being extracted.
+ */
+static void carve_end(carve_t* carve, int type, uint64_t start, uint64_t end) {
+    size_t i;
+    for (i=0; i < carve->extractCount; i++) {
+        struct carve_extract* extract = &carve->extracts[i];
+        if (extract->type != type || extract->start != start) {
+            continue;
+        }
+
+        // The bytes before the current block have been written already,
+        // which can be a few more than the file if its end is at the
+        // end of the previous block.
+        uint64_t written = extract->written;
+        if (end - extract->start >= written) {
+            if (end - extract->start - written < extract->remaining) {
+                extract->remaining = end - extract->start - written;
+            }
+        }
+        else {
+            extract->remaining = 0;
+            if (fflush(extract->fp) != 0 ||
+                    ftruncate(fileno(extract->fp), end - extract->start) != 0) {
+                carve->failed = true;
+            }
+        }
+        if (extract->remaining == 0) {
+            carve_close(carve, i);
+        }
+        break;
+    }
+}
+
+/**
+ * Close the open ZIP archive at the end of central directory record at
+ * *offset*, and end its extraction with the record.
+ */
+static void carve_zip_end(carve_t* carve, const unsigned char* bytes,
+                          size_t available, uint64_t offset) {
+    if (!carve->zipOpen || offset < carve->zipDataEnd || available < 22) {
+        return;
+    }
+    carve->zipOpen = false;
+    carve_end(carve, CARVE_ZIP, carve->zipStart, offset + 22 + read_le(bytes + 20, 2));
+}
+
+// The states of the JPEG parser: before the FF of a marker, at the type
+// of a marker, at the two bytes of the length of a segment, in the rest
+// of a segment, in the entropy-coded data after a start of scan, and
+// after an FF in that data.
+enum {
+    JPEG_MARKER,
+    JPEG_TYPE,
+    JPEG_LENGTH,
+    JPEG_LENGTH_LOW,
+    JPEG_SEGMENT,
+    JPEG_DATA,
+    JPEG_DATA_FF
+};
+
+/**
+ * Stop parsing the open JPEG image before *end*. If it is *complete*,
+ * its extraction ends there as well, otherwise its segments could not
+ * be parsed or it is too large.
+ */
+static void carve_jpeg_close(carve_t* carve, uint64_t end, bool complete) {
+    carve->jpegOpen = false;
+    carve->jpegEnd = end;
+    if (complete) {
+        carve_end(carve, CARVE_JPEG, carve->jpegStart, end);
+        return;
+    }
+
+    // Without the structure, the extraction ends with the first end of
+    // image marker, which may still follow.
+    size_t i;
+    for (i=0; i < carve->extractCount; i++) {
+        struct carve_extract* extract = &carve->extracts[i];
+        if (extract->type != CARVE_JPEG || extract->start != carve->jpegStart) {
+            continue;
+        }
+        if (extract->firstEnd != 0) {
+            carve_end(carve, CARVE_JPEG, extract->start, extract->firstEnd);
+        }
+        else {
+            extract->damaged = true;
+        }
+        break;
+    }
+}
+
+/**
+ * Handle the marker *type* of the open JPEG image, which is at the
+ * absolute offset *offset*. Returns false if the image ended.
+ */
+static bool carve_jpeg_marker(carve_t* carve, unsigned char type, uint64_t offset) {
+    if (type == 0xD9) {
+        carve_jpeg_close(carve, offset + 1, true);
+        return false;
+    }
+    if (type == 0x00) {
+        carve_jpeg_close(carve, offset, false);
+        return false;
+    }
+    if (type == 0xFF) {
+        // Fill bytes before a marker.
+        carve->jpegState = JPEG_TYPE;
+    }
+    else if (type == 0xD8 || type == 0x01 || (type >= 0xD0 && type <= 0xD7)) {
+        // Markers without a segment.
+        carve->jpegState = JPEG_MARKER;
+    }
+    else {
+        carve->jpegScan = type == 0xDA;
+        carve->jpegState = JPEG_LENGTH;
+    }
+    return true;
+}
+
+/**
+ * Parse the next *size* bytes of the open JPEG image. Segments are
+ * skipped by their length, so markers in them, like those of an EXIF
+ * thumbnail, are not seen.
+ */
+static void carve_jpeg_parse(carve_t* carve, const unsigned char* data, size_t size) {
+    size_t i = 0;
+    while (i < size && carve->jpegOpen) {
+        if (carve->jpegState == JPEG_SEGMENT) {
+            size_t skip = size - i < carve->jpegSkip ? size - i : carve->jpegSkip;
+            i += skip;
+            carve->jpegSkip -= skip;
+            if (carve->jpegSkip == 0) {
+                carve->jpegState = carve->jpegScan ? JPEG_DATA : JPEG_MARKER;
+            }
+            continue;
+        }
+        if (carve->jpegState == JPEG_DATA) {
+            const unsigned char* marker = memchr(data + i, 0xFF, size - i);
+            if (!marker) {
+                i = size;
+                continue;
+            }
+            i = marker - data + 1;
+            carve->jpegState = JPEG_DATA_FF;
+            continue;
+        }
+
+        uint64_t offset = carve->jpegPosition + i;
+        unsigned char byte = data[i++];
+        switch (carve->jpegState) {
+            case JPEG_MARKER:
+                if (byte != 0xFF) {
+                    carve_jpeg_close(carve, offset, false);
+                    return;
+                }
+                carve->jpegState = JPEG_TYPE;
+                break;
+            case JPEG_TYPE:
+                if (!carve_jpeg_marker(carve, byte, offset)) {
+                    return;
+                }
+                break;
+            case JPEG_LENGTH:
+                carve->jpegSkip = (uint32_t) byte << 8;
+                carve->jpegState = JPEG_LENGTH_LOW;
+                break;
+            case JPEG_LENGTH_LOW:
+                // The length includes its own two bytes.
+                carve->jpegSkip |= byte;
+                if (carve->jpegSkip < 2) {
+                    carve_jpeg_close(carve, offset, false);
+                    return;
+                }
+                carve->jpegSkip -= 2;
+                carve->jpegState = JPEG_SEGMENT;
+                break;
+            case JPEG_DATA_FF:
+                // Stuffed zero bytes and restart markers are part of
+                // the data, other markers start a segment between scans.
+                if (byte == 0x00 || (byte >= 0xD0 && byte <= 0xD7)) {
+                    carve->jpegState = JPEG_DATA;
+                }
+                else if (!carve_jpeg_marker(carve, byte, offset)) {
+                    return;
+                }
+                break;
+        }
+    }
+    carve->jpegPosition += i;
+
+    // An image without an end is not followed further than it would
+    // be extracted.
+    if (carve->jpegOpen && carve->jpegPosition - carve->jpegStart >= carve->extractSize) {
+        carve_jpeg_close(carve, carve->jpegPosition, false);
+    }
+}
+
+/**
+ * Parse the open JPEG image up to the absolute offset *to* in the
+ * *data* that starts at *position*.
+ */
+static void carve_jpeg_advance(carve_t* carve, const unsigned char* data,
+                               uint64_t position, uint64_t to) {
+    if (carve->jpegOpen && carve->jpegPosition >= position && carve->jpegPosition < to) {
+        carve_jpeg_parse(carve, data + (carve->jpegPosition - position),
+                         to - carve->jpegPosition);
+    }
+}
+
+/**
+ * Returns true if the start of image marker at *offset* is in the JPEG
+ * image that is open or ended after it, otherwise it opens a new image.
+ */
+static bool carve_jpeg_member(carve_t* carve, uint64_t offset) {
+    if (offset > carve->jpegStart && (carve->jpegOpen || offset < carve->jpegEnd)) {
+        return true;
+    }
+    carve->jpegOpen = true;
+    carve->jpegStart = offset;
+    carve->jpegPosition = offset;
+    carve->jpegState = JPEG_MARKER;
+    carve->jpegScan = false;
+    return false;
+}
+
+/**
+ * Check the position *offset* for signatures. *bytes* are the
+ * *available* bytes from it on, which are at most `CARVE_WINDOW`.
+ * *pendingLength* of them were fed before the current block.
+ */
+static bool carve_check(carve_t* carve, const unsigned char* bytes, size_t available,
+                        uint64_t offset, size_t pendingLength) {
+    if (available < 2) {
+        return true;
+    }
+    unsigned int candidates = carve->prefixes[bytes[0] | (bytes[1] << 8)];
+    if ((candidates & (1 << CARVE_ZIP)) && available >= 4 &&
+            memcmp(bytes, "PK\x05\x06", 4) == 0) {
+        carve_zip_end(carve, bytes, available, offset);
+        return true;
+    }
+    int type;
+    for (type=0; candidates; type++, candidates >>= 1) {
+        carve_hit_t hit;
+        if (!(candidates & 1) || !carve_validate(type, bytes, available, &hit.size)) {
+            continue;
+        }
+        if (type == CARVE_ZIP && carve_zip_member(carve, bytes, available, offset)) {
+            continue;
+        }
+        if (type == CARVE_JPEG && carve_jpeg_member(carve, offset)) {
+            continue;
+        }
+        hit.type = type;
+        hit.offset = offset;
+        hit.extracted = false;
+        if (carve->directory && !carve_extract(carve, &hit, bytes, pendingLength)) {
+            return false;
+        }
+        if (!carve->callback(carve->user, &hit)) {
+            return false;
+        }
+
+        // The bytes of a new image that were fed before are parsed now,
+        // the others with the block.
+        if (type == CARVE_JPEG) {
+            carve_jpeg_parse(carve, bytes, pendingLength);
+        }
+    }
+    return true;
+}
+
+bool carve_feed(carve_t* carve, const void* data, size_t size) {
+    const unsigned char* bytes = data;
+    size_t historyLength = carve->historyLength;
+    uint64_t historyStart = carve->position - historyLength;
+
+    // Check the positions at the end of the previous blocks, which now
+    // have enough bytes after them.
+    unsigned char window[CARVE_WINDOW * 2];
+    size_t take = size < CARVE_WINDOW - 1 ? size : CARVE_WINDOW - 1;
+    memcpy(window, carve->history, historyLength);
+    memcpy(window + historyLength, bytes, take);
+    size_t windowLength = historyLength + take;
+    size_t i;
+    for (i=0; i < historyLength && windowLength - i >= CARVE_WINDOW; i++) {
+        if (!carve_check(carve, window + i, CARVE_WINDOW, historyStart + i,
+                         historyLength - i)) {
+            return false;
+        }
+    }
+
+    // Most positions do not start with the first two bytes of any
+    // signature and are skipped with a single lookup.
+    for (i=0; i + CARVE_WINDOW <= size; i++) {
+        if (!carve->prefixes[bytes[i] | (bytes[i + 1] << 8)]) {
+            continue;
+        }
+        carve_jpeg_advance(carve, bytes, carve->position, carve->position + i);
+        if (!carve_check(carve, bytes + i, CARVE_WINDOW, carve->position + i, 0)) {
+            return false;
+        }
+    }
+    carve_jpeg_advance(carve, bytes, carve->position, carve->position + size);
+
+    // Pass the block to the files that are being extracted.
+    i = 0;
+    while (i < carve->extractCount) {
+        struct carve_extract* extract = &carve->extracts[i];
+        size_t from = 0;
+        if (extract->start > carve->position) {
+            from = extract->start - carve->position;
+        }
+        if (from >= size || carve_write(carve, i, bytes + from, size - from)) {
+            i++;
+        }
+    }
+
+    // Keep the positions that can not be checked yet.
+    if (size >= CARVE_WINDOW - 1) {
+        carve->historyLength = CARVE_WINDOW - 1;
+        memcpy(carve->history, bytes + size - carve->historyLength, carve->historyLength);
+    }
+    else {
+        carve->historyLength = windowLength < CARVE_WINDOW - 1 ? windowLength : CARVE_WINDOW - 1;
+        memcpy(carve->history, window + windowLength - carve->historyLength,
+               carve->historyLength);
+    }
+    carve->position += size;
+    if (carve->failed) {
+        errno = EIO;
+        return false;
+    }
+    return true;
+}
+
+bool carve_finish(carve_t* carve) {
+    uint64_t historyStart = carve->position - carve->historyLength;
+    bool result = true;
+    size_t i;
+    for (i=0; i < carve->historyLength && result; i++) {
+        result = carve_check(carve, carve->history + i, carve->historyLength - i,
+                             historyStart + i, carve->historyLength - i);
+    }
+    carve->historyLength = 0;
+    carve->zipOpen = false;
+    carve->jpegOpen = false;
+    carve->jpegStart = 0;
+    carve->jpegEnd = 0;
+    while (carve->extractCount > 0) {
+        carve_close(carve, 0);
+    }
+    if (carve->failed) {
+        carve->failed = false;
+        return false;
+    }
+    return result;
+}
+
+bool carve_seek(carve_t* carve, uint64_t position) {
+    bool result = carve_finish(carve);
+    carve->position = position;
+    return result;
+}
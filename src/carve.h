@@ -0,0 +1,201 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef CARVE_H__
+#define CARVE_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stdio.h>
+
+    #include "memory.h"
+
+    /**
+     * The kinds of files that are recognized by their signature.
+     */
+    enum {
+        CARVE_PDF,
+        CARVE_ZIP,
+        CARVE_JPEG,
+        CARVE_SQLITE,
+        CARVE_TYPE_COUNT
+    };
+
+    /**
+     * The number of bytes after the start of a signature that are
+     * inspected to validate it.
+     */
+    #define CARVE_WINDOW 32
+
+    /**
+     * The default number of bytes that are extracted for a signature.
+     */
+    #define CARVE_EXTRACT_SIZE (16 * 1024 * 1024)
+
+    /**
+     * The maximum number of files that are extracted at the same time.
+     * Signatures that are found while this many are still incomplete
+     * are only reported.
+     */
+    #define CARVE_MAX_EXTRACTS 64
+
+    /**
+     * A signature found in the stream.
+     */
+    struct carve_hit {
+        int type;
+        uint64_t offset;
+
+        // The size of the file as recorded in its header, zero if it is
+        // not known.
+        uint64_t size;
+
+        // True if the file is extracted.
+        bool extracted;
+    };
+
+    typedef struct carve_hit carve_hit_t;
+
+    /**
+     * Called for every signature in the order of the stream. Return
+     * false to abort.
+     */
+    typedef bool (*carve_fn)(void* user, const carve_hit_t* hit);
+
+    /**
+     * A file that is being extracted.
+     */
+    struct carve_extract {
+        FILE* fp;
+        int type;
+        uint64_t start;
+        uint64_t written;
+        uint64_t remaining;
+
+        // The offset after the first end of image marker of a JPEG
+        // image, 0 until it is written, where the image ends if its
+        // segments are *damaged*. *lastFF* is true if the last byte
+        // written was 0xFF, to find the marker across blocks.
+        uint64_t firstEnd;
+        bool damaged;
+        bool lastFF;
+    };
+
+    /**
+     * Finds file signatures in a stream of any data in a single pass.
+     * The stream is fed in blocks of any size, positions at the end of
+     * a block are checked once the next block provides enough bytes to
+     * validate them.
+     */
+    struct carve {
+        // The signatures whose first two bytes are the index, as a bit
+        // for every type.
+        uint8_t prefixes[65536];
+
+        carve_fn callback;
+        void* user;
+
+        // The absolute offset of the next byte that is fed.
+        uint64_t position;
+
+        // The last bytes fed, which have not been checked yet.
+        unsigned char history[CARVE_WINDOW - 1];
+        size_t historyLength;
+
+        // Extraction is enabled if *directory* is not NULL. Files are
+        // named `<prefix><offset>.<extension>`.
+        const char* directory;
+        char prefix[32];
+        uint64_t extractSize;
+        struct carve_extract extracts[CARVE_MAX_EXTRACTS];
+        size_t extractCount;
+        bool failed;
+
+        // The ZIP archive that is open, from its first local header on.
+        // The local headers of its other members are not reported. A
+        // header up to *zipLimit* continues the archive, and the first
+        // end of central directory record after *zipDataEnd* ends it.
+        bool zipOpen;
+        uint64_t zipStart;
+        uint64_t zipDataEnd;
+        uint64_t zipLimit;
+
+        // The JPEG image that is open, from its start of image marker
+        // on. Its segments are parsed as it is fed, up to *jpegPosition*,
+        // so the start of image markers of thumbnails in it are not
+        // reported and only the end of image marker after its scans
+        // ends it. A closed image ended before *jpegEnd*.
+        bool jpegOpen;
+        uint64_t jpegStart;
+        uint64_t jpegEnd;
+        uint64_t jpegPosition;
+        int jpegState;
+        bool jpegScan;
+        uint32_t jpegSkip;
+    };
+
+    typedef struct carve carve_t;
+
+    /**
+     * Returns the name of the type, e.g. "pdf".
+     */
+    const char* carve_type_name(int type);
+
+    /**
+     * Allocate a carver that calls *callback* for every signature.
+     * If *directory* is not NULL, up to *extractSize* bytes starting at
+     * every signature are written to a file in it. Returns NULL if the
+     * memory can not be allocated.
+     */
+    carve_t* carve_alloc(const char* directory, uint64_t extractSize,
+                         carve_fn callback, void* user);
+
+    /**
+     * Free the carver. Incomplete extractions are closed.
+     */
+    void carve_free(carve_t* carve);
+
+    /**
+     * Start a new stream at the absolute offset *position*. Files that
+     * are extracted from it are named with *prefix*, which can be
+     * NULL.
+     */
+    void carve_reset(carve_t* carve, uint64_t position, const char* prefix);
+
+    /**
+     * Search the next *size* bytes of the stream. Returns false if the
+     * callback aborted or an extracted file could not be written.
+     */
+    bool carve_feed(carve_t* carve, const void* data, size_t size);
+
+    /**
+     * Check the remaining positions at the end of the stream and close
+     * all extracted files.
+     */
+    bool carve_finish(carve_t* carve);
+
+    /**
+     * End the stream like `carve_finish()` and continue with another
+     * one at the absolute offset *position*, e.g. after a gap in the
+     * input. The prefix of the extracted files is kept.
+     */
+    bool carve_seek(carve_t* carve, uint64_t position);
+
+#endif /* CARVE_H__ */
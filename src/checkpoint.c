@@ -0,0 +1,115 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "checkpoint.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+bool checkpoint_write(const char* path, const checkpoint_t* checkpoint,
+                      const dedup_t* dedup) {
+    char* temp = allocate(strlen(path) + 5);
+    if (!temp) {
+        return false;
+    }
+    sprintf(temp, "%s.tmp", path);
+
+    FILE* fp = fopen(temp, "wb");
+    if (!fp) {
+        deallocate(temp);
+        return false;
+    }
+
+    uint32_t header[2];
+    memcpy(header, CHECKPOINT_MAGIC, 4);
+    header[1] = CHECKPOINT_VERSION;
+    uint64_t values[9];
+    values[0] = checkpoint->fingerprint;
+    values[1] = checkpoint->file;
+    values[2] = checkpoint->position;
+    values[3] = checkpoint->fileStarted;
+    values[4] = checkpoint->progress;
+    values[5] = checkpoint->chunkCount;
+    values[6] = checkpoint->duplicateCount;
+    values[7] = checkpoint->indexSize;
+    values[8] = checkpoint->outputCount;
+
+    size_t count = checkpoint->outputCount;
+    bool result = fwrite(header, sizeof(header), 1, fp) == 1 &&
+            fwrite(values, sizeof(values), 1, fp) == 1 &&
+            fwrite(checkpoint->outputSizes, sizeof(uint64_t), count, fp) == count &&
+            fwrite(checkpoint->headerFiles, sizeof(uint64_t), count, fp) == count;
+    if (result && dedup) {
+        result = dedup_save(dedup, fp);
+    }
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        result = false;
+    }
+    if (fclose(fp) != 0) {
+        result = false;
+    }
+    if (result && rename(temp, path) != 0) {
+        result = false;
+    }
+    if (!result) {
+        unlink(temp);
+    }
+    deallocate(temp);
+    return result;
+}
+
+bool checkpoint_read(const char* path, checkpoint_t* checkpoint,
+                     dedup_t* dedup) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+
+    uint32_t header[2];
+    uint64_t values[9];
+    size_t count = checkpoint->outputCount;
+    bool result = fread(header, sizeof(header), 1, fp) == 1 &&
+            memcmp(header, CHECKPOINT_MAGIC, 4) == 0 &&
+            header[1] == CHECKPOINT_VERSION &&
+            fread(values, sizeof(values), 1, fp) == 1 &&
+            values[8] == count &&
+            fread(checkpoint->outputSizes, sizeof(uint64_t), count, fp) == count &&
+            fread(checkpoint->headerFiles, sizeof(uint64_t), count, fp) == count;
+    if (result && dedup) {
+        result = dedup_load(dedup, fp);
+    }
+    fclose(fp);
+    if (!result) {
+        errno = EINVAL;
+        return false;
+    }
+
+    checkpoint->fingerprint = values[0];
+    checkpoint->file = values[1];
+    checkpoint->position = values[2];
+    checkpoint->fileStarted = values[3] != 0;
+    checkpoint->progress = values[4];
+    checkpoint->chunkCount = values[5];
+    checkpoint->duplicateCount = values[6];
+    checkpoint->indexSize = values[7];
+    return true;
+}
@@ -0,0 +1,89 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef CHECKPOINT_H__
+#define CHECKPOINT_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+
+    #include "dedup.h"
+    #include "memory.h"
+
+    /**
+     * A checkpoint file starts with this magic and version. The data
+     * is stored in the byte order of the machine, checkpoints are only
+     * meant to continue a scan on the same system.
+     */
+    #define CHECKPOINT_MAGIC "DFCP"
+    #define CHECKPOINT_VERSION 2
+
+    /**
+     * The state of a scan at a position where the scanner had just been
+     * reset. Everything before that position has been written to the
+     * outputs, which had the recorded sizes at that time.
+     */
+    struct checkpoint {
+        // A hash of all options that change the results, so a scan is
+        // only continued with the same ones.
+        uint64_t fingerprint;
+
+        // The index of the file to continue and the position to
+        // continue at. *fileStarted* is false if no results of the file
+        // have been written yet.
+        uint64_t file;
+        uint64_t position;
+        bool fileStarted;
+
+        // Counters of the scan.
+        uint64_t progress;
+        uint64_t chunkCount;
+        uint64_t duplicateCount;
+
+        // The sizes of the index and the outputs, and the state of the
+        // file headers of every output.
+        uint64_t indexSize;
+        uint32_t outputCount;
+        uint64_t* outputSizes;
+        uint64_t* headerFiles;
+    };
+
+    typedef struct checkpoint checkpoint_t;
+
+    /**
+     * Write the checkpoint and the contents of *dedup* (which can be
+     * NULL) to *path*. The file is replaced atomically and synced to
+     * the disk. Returns false on failure.
+     */
+    bool checkpoint_write(const char* path, const checkpoint_t* checkpoint,
+                          const dedup_t* dedup);
+
+    /**
+     * Read the checkpoint at *path*. The *outputCount* and the arrays
+     * must be set by the caller, the count must match the checkpoint.
+     * *dedup* is restored as well if it is not NULL. Returns false on
+     * failure, *errno* is ENOENT if the file does not exist and EINVAL
+     * if it is not a valid checkpoint.
+     */
+    bool checkpoint_read(const char* path, checkpoint_t* checkpoint,
+                         dedup_t* dedup);
+
+#endif /* CHECKPOINT_H__ */
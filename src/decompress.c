@@ -0,0 +1,627 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "decompress.h"
+#include "blockqueue.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+// The size of the decompressed blocks and how many of them may be
+// waiting for the reader.
+#define DECOMPRESS_BLOCK_SIZE (1024 * 1024)
+#define DECOMPRESS_QUEUE_DEPTH 8
+
+// The size of the reads from the compressed file.
+#define DECOMPRESS_INPUT_SIZE (256 * 1024)
+
+#define DECOMPRESS_MAX_THREADS 64
+
+// Frames of seekable zstd files that are at most this large are
+// decompressed in parallel into a block each, larger ones are streamed
+// through blocks of the normal size.
+#define DECOMPRESS_FRAME_LIMIT (4 * 1024 * 1024)
+
+struct decompressor {
+    int format;
+    int fd;
+    bool seekable;
+    unsigned char prefix[16];
+    size_t prefixSize;
+
+    blockqueue_t* queue;
+    pthread_t threads[DECOMPRESS_MAX_THREADS];
+    int threadCount;
+
+    // The block that is currently read by the consumer.
+    blockqueue_block_t* current;
+    size_t currentPos;
+    bool ended;
+    bool failed;
+
+    // Seekable zstd files are mapped, the workers take the frames one
+    // after another.
+    pthread_mutex_t frameLock;
+    unsigned char* map;
+    size_t mapSize;
+    size_t mapPos;
+    int activeWorkers;
+};
+
+int decompress_detect(const void* magic, size_t size) {
+    const unsigned char* m = magic;
+    if (size >= 2 && m[0] == 0x1f && m[1] == 0x8b) {
+        return DECOMPRESS_GZIP;
+    }
+    if (size >= 4 && m[0] == 0x28 && m[1] == 0xb5 && m[2] == 0x2f &&
+            m[3] == 0xfd) {
+        return DECOMPRESS_ZSTD;
+    }
+    return DECOMPRESS_NONE;
+}
+
+int decompress_parse(const char* name) {
+    if (strcmp(name, "auto") == 0) {
+        return DECOMPRESS_AUTO;
+    }
+    if (strcmp(name, "none") == 0) {
+        return DECOMPRESS_NONE;
+    }
+    if (strcmp(name, "gzip") == 0) {
+        return DECOMPRESS_GZIP;
+    }
+    if (strcmp(name, "zstd") == 0) {
+        return DECOMPRESS_ZSTD;
+    }
+    return -2;
+}
+
+const char* decompress_name(int format) {
+    switch (format) {
+        case DECOMPRESS_AUTO:
+            return "auto";
+        case DECOMPRESS_GZIP:
+            return "gzip";
+        case DECOMPRESS_ZSTD:
+            return "zstd";
+        default:
+            return "none";
+    }
+}
+
+bool decompress_supported(int format) {
+    #ifdef HAVE_ZSTD
+        (void) format;
+        return true;
+    #else
+        return format != DECOMPRESS_ZSTD;
+    #endif
+}
+
+/**
+ * Read the next piece of compressed data, the prefix first. Returns
+ * the number of bytes read, zero at the end and -1 on error.
+ */
+static ssize_t decompress_input(
+        decompressor_t* decompressor, unsigned char* buffer, size_t size) {
+    if (decompressor->prefixSize > 0) {
+        size_t n = decompressor->prefixSize;
+        memcpy(buffer, decompressor->prefix, n);
+        decompressor->prefixSize = 0;
+        return n;
+    }
+    for (;;) {
+        ssize_t bytes = read(decompressor->fd, buffer, size);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        return bytes;
+    }
+}
+
+/**
+ * Report the data after the last member of a gzip file, which starts
+ * with the *size* bytes in *data*. The rest of the file is read to tell
+ * padding with zeros from other data.
+ */
+static void decompress_trailing(decompressor_t* decompressor,
+                                const unsigned char* data, size_t size, bool eof) {
+    unsigned char buffer[4096];
+    bool zeros = true;
+    for (;;) {
+        size_t i;
+        for (i=0; i < size && zeros; i++) {
+            zeros = data[i] == 0;
+        }
+        if (!zeros || eof) {
+            break;
+        }
+        ssize_t bytes = decompress_input(decompressor, buffer, sizeof(buffer));
+        if (bytes <= 0) {
+            break;
+        }
+        data = buffer;
+        size = bytes;
+    }
+    fprintf(stderr, "gzip: %s after the last member ignored.\n",
+            zeros ? "trailing zero bytes" : "trailing garbage");
+}
+
+static void* decompress_gzip_main(void* arg) {
+    decompressor_t* decompressor = arg;
+    blockqueue_t* queue = decompressor->queue;
+
+    unsigned char* input = allocate(DECOMPRESS_INPUT_SIZE);
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // Accept gzip and zlib headers.
+    if (!input || inflateInit2(&stream, 15 + 32) != Z_OK) {
+        if (input) {
+            deallocate(input);
+        }
+        blockqueue_finish(queue, true);
+        return NULL;
+    }
+
+    bool error = false;
+    bool eof = false;
+    bool complete = false;
+    uint64_t seq;
+    blockqueue_block_t* block = blockqueue_claim(queue, &seq);
+    while (block) {
+        // After the end of a member, another one needs its two magic
+        // bytes in the buffer to be recognized.
+        size_t needed = complete ? 2 : 1;
+        if (stream.avail_in < needed && !eof) {
+            memmove(input, stream.next_in, stream.avail_in);
+            ssize_t bytes = decompress_input(
+                    decompressor, input + stream.avail_in,
+                    DECOMPRESS_INPUT_SIZE - stream.avail_in);
+            if (bytes < 0) {
+                error = true;
+                break;
+            }
+            eof = bytes == 0;
+            stream.next_in = input;
+            stream.avail_in += bytes;
+            continue;
+        }
+        if (stream.avail_in == 0 && eof) {
+            break;
+        }
+        if (complete) {
+            // Like gzip, ignore padding and other data that follows the
+            // last member.
+            if (stream.avail_in < 2 || stream.next_in[0] != 0x1f ||
+                    stream.next_in[1] != 0x8b) {
+                decompress_trailing(decompressor, stream.next_in, stream.avail_in, eof);
+                break;
+            }
+            inflateReset(&stream);
+        }
+
+        stream.next_out = (unsigned char*) block->data + block->size;
+        stream.avail_out = block->capacity - block->size;
+        int ret = inflate(&stream, Z_NO_FLUSH);
+        block->size = block->capacity - stream.avail_out;
+        complete = false;
+        if (ret == Z_STREAM_END) {
+            // Concatenated gzip members form a single stream.
+            complete = true;
+        }
+        else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            error = true;
+            break;
+        }
+
+        if (block->size == block->capacity) {
+            blockqueue_submit(queue, seq);
+            block = blockqueue_claim(queue, &seq);
+        }
+    }
+
+    if (block) {
+        blockqueue_submit(queue, seq);
+    }
+    // A stream that ends inside of a member is truncated.
+    blockqueue_finish(queue, error || (block && !complete));
+
+    inflateEnd(&stream);
+    deallocate(input);
+    return NULL;
+}
+
+#ifdef HAVE_ZSTD
+
+    static void* decompress_zstd_main(void* arg) {
+        decompressor_t* decompressor = arg;
+        blockqueue_t* queue = decompressor->queue;
+
+        unsigned char* input = allocate(DECOMPRESS_INPUT_SIZE);
+        ZSTD_DStream* stream = ZSTD_createDStream();
+        if (!input || !stream) {
+            if (input) {
+                deallocate(input);
+            }
+            ZSTD_freeDStream(stream);
+            blockqueue_finish(queue, true);
+            return NULL;
+        }
+        ZSTD_initDStream(stream);
+
+        bool error = false;
+        bool complete = false;
+        ZSTD_inBuffer in = {input, 0, 0};
+        uint64_t seq;
+        blockqueue_block_t* block = blockqueue_claim(queue, &seq);
+        while (block) {
+            if (in.pos == in.size) {
+                ssize_t bytes = decompress_input(
+                        decompressor, input, DECOMPRESS_INPUT_SIZE);
+                if (bytes < 0) {
+                    error = true;
+                    break;
+                }
+                if (bytes == 0) {
+                    break;
+                }
+                in.size = bytes;
+                in.pos = 0;
+            }
+
+            ZSTD_outBuffer out = {block->data, block->capacity, block->size};
+            size_t ret = ZSTD_decompressStream(stream, &out, &in);
+            if (ZSTD_isError(ret)) {
+                error = true;
+                break;
+            }
+            block->size = out.pos;
+            complete = ret == 0;
+
+            if (block->size == block->capacity) {
+                blockqueue_submit(queue, seq);
+                block = blockqueue_claim(queue, &seq);
+            }
+        }
+
+        if (block) {
+            blockqueue_submit(queue, seq);
+        }
+        blockqueue_finish(queue, error || (block && !complete));
+
+        ZSTD_freeDStream(stream);
+        deallocate(input);
+        return NULL;
+    }
+
+    /**
+     * Decompress one frame of a mapped zstd file into *block*, growing
+     * the block to the content size of the frame, which is at most
+     * `DECOMPRESS_FRAME_LIMIT`. Returns false on error.
+     */
+    static bool decompress_zstd_frame(
+            ZSTD_DCtx* context, blockqueue_block_t* block,
+            const unsigned char* frame, size_t frameSize) {
+        unsigned long long contentSize =
+                ZSTD_getFrameContentSize(frame, frameSize);
+        if (contentSize != ZSTD_CONTENTSIZE_UNKNOWN &&
+                contentSize != ZSTD_CONTENTSIZE_ERROR &&
+                contentSize <= ((size_t) -1) / 2) {
+            if (!blockqueue_reserve(block, contentSize)) {
+                return false;
+            }
+        }
+
+        ZSTD_DCtx_reset(context, ZSTD_reset_session_only);
+        ZSTD_inBuffer in = {frame, frameSize, 0};
+        for (;;) {
+            if (block->size == block->capacity &&
+                    !blockqueue_reserve(block, block->capacity * 2)) {
+                return false;
+            }
+            ZSTD_outBuffer out = {block->data, block->capacity, block->size};
+            size_t ret = ZSTD_decompressStream(context, &out, &in);
+            if (ZSTD_isError(ret)) {
+                return false;
+            }
+            block->size = out.pos;
+            if (ret == 0) {
+                return true;
+            }
+            if (in.pos == in.size && out.pos < out.size) {
+                // The frame is truncated.
+                return false;
+            }
+        }
+    }
+
+    /**
+     * Decompress a frame of unknown or large size at the start of
+     * *data* through blocks of the normal size. The number of bytes of
+     * the frame is assigned to *outFrameSize*. Returns false on error.
+     */
+    static bool decompress_zstd_stream(
+            ZSTD_DCtx* context, blockqueue_t* queue,
+            const unsigned char* data, size_t size, size_t* outFrameSize) {
+        ZSTD_DCtx_reset(context, ZSTD_reset_session_only);
+        ZSTD_inBuffer in = {data, size, 0};
+        *outFrameSize = size;
+        for (;;) {
+            uint64_t seq;
+            blockqueue_block_t* block = blockqueue_claim(queue, &seq);
+            if (!block) {
+                return true;
+            }
+            size_t ret = 1;
+            while (block->size < block->capacity) {
+                ZSTD_outBuffer out = {block->data, block->capacity, block->size};
+                ret = ZSTD_decompressStream(context, &out, &in);
+                block->size = out.pos;
+                if (ZSTD_isError(ret) || ret == 0 ||
+                        (in.pos == in.size && out.pos < out.size)) {
+                    break;
+                }
+            }
+            blockqueue_submit(queue, seq);
+            if (ret == 0) {
+                *outFrameSize = in.pos;
+                return true;
+            }
+            if (ZSTD_isError(ret) || in.pos == in.size) {
+                return false;
+            }
+        }
+    }
+
+    static void* decompress_zstd_worker(void* arg) {
+        decompressor_t* decompressor = arg;
+        blockqueue_t* queue = decompressor->queue;
+        ZSTD_DCtx* context = ZSTD_createDCtx();
+        bool error = !context;
+
+        while (!error) {
+            // Take the next frame and claim the block for it at the same
+            // time, so the blocks are in the order of the frames.
+            pthread_mutex_lock(&decompressor->frameLock);
+            if (decompressor->mapPos >= decompressor->mapSize) {
+                pthread_mutex_unlock(&decompressor->frameLock);
+                break;
+            }
+            const unsigned char* frame =
+                    decompressor->map + decompressor->mapPos;
+            size_t available = decompressor->mapSize - decompressor->mapPos;
+
+            // Large frames are streamed in order while the next frame
+            // waits, so the memory of a block stays bounded.
+            unsigned long long contentSize = ZSTD_getFrameContentSize(frame, available);
+            if (contentSize == ZSTD_CONTENTSIZE_UNKNOWN ||
+                    contentSize == ZSTD_CONTENTSIZE_ERROR ||
+                    contentSize > DECOMPRESS_FRAME_LIMIT) {
+                size_t frameSize;
+                error = !decompress_zstd_stream(context, queue, frame, available,
+                                                &frameSize);
+                decompressor->mapPos = error ? decompressor->mapSize :
+                        decompressor->mapPos + frameSize;
+                pthread_mutex_unlock(&decompressor->frameLock);
+                continue;
+            }
+
+            size_t frameSize = ZSTD_findFrameCompressedSize(frame, available);
+            if (ZSTD_isError(frameSize)) {
+                decompressor->mapPos = decompressor->mapSize;
+                pthread_mutex_unlock(&decompressor->frameLock);
+                error = true;
+                break;
+            }
+            decompressor->mapPos += frameSize;
+            uint64_t seq;
+            blockqueue_block_t* block = blockqueue_claim(queue, &seq);
+            pthread_mutex_unlock(&decompressor->frameLock);
+            if (!block) {
+                break;
+            }
+
+            error = !decompress_zstd_frame(context, block, frame, frameSize);
+            blockqueue_submit(queue, seq);
+            if (error) {
+                // No frames are started after a corrupt one.
+                pthread_mutex_lock(&decompressor->frameLock);
+                decompressor->mapPos = decompressor->mapSize;
+                pthread_mutex_unlock(&decompressor->frameLock);
+            }
+        }
+
+        ZSTD_freeDCtx(context);
+
+        pthread_mutex_lock(&decompressor->frameLock);
+        bool last = --decompressor->activeWorkers == 0;
+        pthread_mutex_unlock(&decompressor->frameLock);
+        if (error || last) {
+            blockqueue_finish(queue, error);
+        }
+        return NULL;
+    }
+
+    /**
+     * Map the rest of a seekable file for the parallel zstd workers.
+     * Returns false if the file can not be mapped.
+     */
+    static bool decompress_map(decompressor_t* decompressor) {
+        struct stat st;
+        off_t offset = lseek(decompressor->fd, 0, SEEK_CUR);
+        if (offset < 0 || fstat(decompressor->fd, &st) != 0 ||
+                !S_ISREG(st.st_mode) || st.st_size <= offset) {
+            return false;
+        }
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+                         decompressor->fd, 0);
+        if (map == MAP_FAILED) {
+            return false;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        decompressor->map = map;
+        decompressor->mapSize = st.st_size;
+        decompressor->mapPos = offset;
+        return true;
+    }
+
+#endif /* HAVE_ZSTD */
+
+decompressor_t* decompressor_start(
+        int format, int fd, bool seekable,
+        const void* prefix, size_t prefixSize, int threads) {
+    if (!decompress_supported(format) || prefixSize > 16 ||
+            (format != DECOMPRESS_GZIP && format != DECOMPRESS_ZSTD)) {
+        return NULL;
+    }
+
+    decompressor_t* decompressor = allocate(sizeof(decompressor_t));
+    if (!decompressor) {
+        return NULL;
+    }
+    memset(decompressor, 0, sizeof(decompressor_t));
+    decompressor->format = format;
+    decompressor->fd = fd;
+    decompressor->seekable = seekable;
+    memcpy(decompressor->prefix, prefix, prefixSize);
+    decompressor->prefixSize = prefixSize;
+    pthread_mutex_init(&decompressor->frameLock, NULL);
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > DECOMPRESS_MAX_THREADS) {
+        threads = DECOMPRESS_MAX_THREADS;
+    }
+
+    size_t depth = DECOMPRESS_QUEUE_DEPTH;
+    if ((size_t) threads * 2 > depth) {
+        depth = threads * 2;
+    }
+    decompressor->queue = blockqueue_alloc(depth, DECOMPRESS_BLOCK_SIZE);
+    if (!decompressor->queue) {
+        decompressor_stop(decompressor);
+        return NULL;
+    }
+
+    void* (*main)(void*) = decompress_gzip_main;
+    int count = 1;
+    #ifdef HAVE_ZSTD
+        if (format == DECOMPRESS_ZSTD) {
+            main = decompress_zstd_main;
+            if (threads > 1 && seekable && prefixSize == 0 &&
+                    decompress_map(decompressor)) {
+                main = decompress_zstd_worker;
+                count = threads;
+            }
+        }
+    #endif
+
+    decompressor->activeWorkers = count;
+    int i;
+    for (i=0; i < count; i++) {
+        if (pthread_create(&decompressor->threads[i], NULL, main,
+                           decompressor) != 0) {
+            break;
+        }
+        decompressor->threadCount++;
+    }
+    if (decompressor->threadCount == 0) {
+        decompressor_stop(decompressor);
+        return NULL;
+    }
+    if (decompressor->threadCount < count) {
+        // The workers that did not start will not finish the queue.
+        pthread_mutex_lock(&decompressor->frameLock);
+        decompressor->activeWorkers -= count - decompressor->threadCount;
+        pthread_mutex_unlock(&decompressor->frameLock);
+    }
+    return decompressor;
+}
+
+ssize_t decompressor_read(
+        decompressor_t* decompressor, void* buffer, size_t size) {
+    size_t filled = 0;
+    while (filled < size) {
+        if (!decompressor->current) {
+            if (decompressor->ended) {
+                break;
+            }
+            decompressor->current = blockqueue_next(decompressor->queue);
+            decompressor->currentPos = 0;
+            if (!decompressor->current) {
+                decompressor->ended = true;
+                decompressor->failed = blockqueue_failed(decompressor->queue);
+                break;
+            }
+        }
+
+        blockqueue_block_t* block = decompressor->current;
+        size_t count = block->size - decompressor->currentPos;
+        if (count > size - filled) {
+            count = size - filled;
+        }
+        memcpy((char*) buffer + filled, block->data + decompressor->currentPos,
+               count);
+        filled += count;
+        decompressor->currentPos += count;
+        if (decompressor->currentPos >= block->size) {
+            blockqueue_release(decompressor->queue);
+            decompressor->current = NULL;
+        }
+    }
+    // The data before an error is returned first.
+    if (filled == 0 && decompressor->failed) {
+        errno = EIO;
+        return -1;
+    }
+    return filled;
+}
+
+void decompressor_stop(decompressor_t* decompressor) {
+    if (!decompressor) {
+        return;
+    }
+    if (decompressor->queue) {
+        blockqueue_close(decompressor->queue);
+    }
+    int i;
+    for (i=0; i < decompressor->threadCount; i++) {
+        pthread_join(decompressor->threads[i], NULL);
+    }
+    if (decompressor->map) {
+        munmap(decompressor->map, decompressor->mapSize);
+    }
+    blockqueue_free(decompressor->queue);
+    pthread_mutex_destroy(&decompressor->frameLock);
+    deallocate(decompressor);
+}
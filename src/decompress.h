@@ -0,0 +1,93 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef DECOMPRESS_H__
+#define DECOMPRESS_H__
+
+    #include <stdbool.h>
+    #include <stddef.h>
+    #include <sys/types.h>
+
+    #include "memory.h"
+
+    #define DECOMPRESS_AUTO -1
+    #define DECOMPRESS_NONE 0
+    #define DECOMPRESS_GZIP 1
+    #define DECOMPRESS_ZSTD 2
+
+    /**
+     * Decompresses a gzip or zstd stream on background threads. The
+     * decompressed data is handed to the reader through a bounded
+     * `blockqueue_t`, so decompression and scanning overlap. zstd
+     * support is only available if compiled with `HAVE_ZSTD`; the
+     * frames of a seekable multi-frame zstd file are decompressed in
+     * parallel.
+     */
+    struct decompressor;
+
+    typedef struct decompressor decompressor_t;
+
+    /**
+     * Returns the format of the data by looking at its first bytes
+     * (at least 4 are required to detect all formats).
+     */
+    int decompress_detect(const void* magic, size_t size);
+
+    /**
+     * Returns the format with the passed name ("auto", "none", "gzip"
+     * or "zstd"), or -2 if the name is unknown.
+     */
+    int decompress_parse(const char* name);
+
+    /**
+     * Returns the name of the format.
+     */
+    const char* decompress_name(int format);
+
+    /**
+     * Returns true if the format can be decompressed by this build.
+     */
+    bool decompress_supported(int format);
+
+    /**
+     * Start decompressing the data read from *fd*. The *prefix* bytes
+     * have already been read from the file descriptor and are
+     * decompressed first. Seekable zstd files are decompressed with up
+     * to *threads* threads. Returns NULL on failure.
+     */
+    decompressor_t* decompressor_start(
+            int format, int fd, bool seekable,
+            const void* prefix, size_t prefixSize, int threads);
+
+    /**
+     * Read up to *size* decompressed bytes. Less than *size* bytes are
+     * only returned at the end of the stream. Returns -1 if the data
+     * could not be read or is corrupt.
+     */
+    ssize_t decompressor_read(
+            decompressor_t* decompressor, void* buffer, size_t size);
+
+    /**
+     * Stop the decompression threads and free the decompressor. The
+     * file descriptor is not closed.
+     */
+    void decompressor_stop(decompressor_t* decompressor);
+
+#endif /* DECOMPRESS_H__ */
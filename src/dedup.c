@@ -0,0 +1,132 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "dedup.h"
+
+#include <string.h>
+
+#define DEDUP_WAYS 4
+
+struct dedup_entry {
+    uint64_t hash;
+    uint64_t length;
+    uint64_t file;
+    uint64_t offset;
+};
+
+struct dedup {
+    struct dedup_entry* entries;
+    size_t bucketMask;
+    unsigned int evict;
+};
+
+dedup_t* dedup_alloc(size_t capacity) {
+    size_t buckets = 1;
+    while (buckets * DEDUP_WAYS < capacity) {
+        buckets *= 2;
+    }
+
+    dedup_t* dedup = allocate(sizeof(dedup_t));
+    if (!dedup) {
+        return NULL;
+    }
+    size_t size = sizeof(struct dedup_entry) * buckets * DEDUP_WAYS;
+    dedup->entries = allocate(size);
+    if (!dedup->entries) {
+        deallocate(dedup);
+        return NULL;
+    }
+
+    // A length of zero marks an empty entry, chunks are never empty.
+    memset(dedup->entries, 0, size);
+    dedup->bucketMask = buckets - 1;
+    dedup->evict = 0;
+    return dedup;
+}
+
+void dedup_free(dedup_t* dedup) {
+    if (dedup) {
+        deallocate(dedup->entries);
+        deallocate(dedup);
+    }
+}
+
+size_t dedup_capacity(const dedup_t* dedup) {
+    return (dedup->bucketMask + 1) * DEDUP_WAYS;
+}
+
+bool dedup_check(dedup_t* dedup, uint64_t hash, uint64_t length,
+                 uint64_t file, uint64_t offset, uint64_t* outFile,
+                 uint64_t* outFirst) {
+    struct dedup_entry* bucket =
+            dedup->entries + (hash & dedup->bucketMask) * DEDUP_WAYS;
+
+    struct dedup_entry* empty = NULL;
+    int i;
+    for (i=0; i < DEDUP_WAYS; i++) {
+        if (bucket[i].length == 0) {
+            if (!empty) {
+                empty = &bucket[i];
+            }
+        }
+        else if (bucket[i].hash == hash && bucket[i].length == length) {
+            if (outFile) {
+                *outFile = bucket[i].file;
+            }
+            if (outFirst) {
+                *outFirst = bucket[i].offset;
+            }
+            return true;
+        }
+    }
+
+    if (!empty) {
+        empty = &bucket[dedup->evict++ % DEDUP_WAYS];
+    }
+    empty->hash = hash;
+    empty->length = length;
+    empty->file = file;
+    empty->offset = offset;
+    return false;
+}
+
+bool dedup_save(const dedup_t* dedup, FILE* fp) {
+    uint64_t header[2];
+    header[0] = dedup_capacity(dedup);
+    header[1] = dedup->evict;
+    if (fwrite(header, sizeof(header), 1, fp) != 1) {
+        return false;
+    }
+    return fwrite(dedup->entries, sizeof(struct dedup_entry),
+                  header[0], fp) == header[0];
+}
+
+bool dedup_load(dedup_t* dedup, FILE* fp) {
+    uint64_t header[2];
+    if (fread(header, sizeof(header), 1, fp) != 1) {
+        return false;
+    }
+    if (header[0] != dedup_capacity(dedup)) {
+        return false;
+    }
+    dedup->evict = header[1];
+    return fread(dedup->entries, sizeof(struct dedup_entry),
+                 header[0], fp) == header[0];
+}
@@ -0,0 +1,82 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef DEDUP_H__
+#define DEDUP_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <stdio.h>
+
+    #include "memory.h"
+
+    /**
+     * A bounded set of the chunks that have already been seen. Chunks
+     * are identified by their `hash64()` and length. The set is four-way
+     * associative: when a bucket is full, one of its entries is evicted,
+     * so the memory use is fixed and a chunk may occasionally be
+     * reported as new even though it was seen long ago.
+     */
+    struct dedup;
+
+    typedef struct dedup dedup_t;
+
+    /**
+     * Allocate a set that remembers about *capacity* chunks. The value
+     * is rounded up to the next power of two. Returns NULL on failure.
+     */
+    dedup_t* dedup_alloc(size_t capacity);
+
+    /**
+     * Free the set.
+     */
+    void dedup_free(dedup_t* dedup);
+
+    /**
+     * Returns the number of entries the set can hold.
+     */
+    size_t dedup_capacity(const dedup_t* dedup);
+
+    /**
+     * Check if a chunk with the passed *hash* and *length* was seen
+     * before. If so, true is returned and *outFile* and *outFirst* are
+     * assigned the *file* and *offset* that were passed when the chunk
+     * was seen the first time. Otherwise the chunk is remembered with
+     * *file* and *offset* and false is returned.
+     */
+    bool dedup_check(dedup_t* dedup, uint64_t hash, uint64_t length,
+                     uint64_t file, uint64_t offset, uint64_t* outFile,
+                     uint64_t* outFirst);
+
+    /**
+     * Write the contents of the set to *fp*, so it can be restored with
+     * `dedup_load()`. Returns false if writing failed.
+     */
+    bool dedup_save(const dedup_t* dedup, FILE* fp);
+
+    /**
+     * Replace the contents of the set with the data written by
+     * `dedup_save()` for a set of the same capacity. Returns false if
+     * reading failed or the capacity does not match.
+     */
+    bool dedup_load(dedup_t* dedup, FILE* fp);
+
+#endif /* DEDUP_H__ */
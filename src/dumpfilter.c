@@ -0,0 +1,372 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "dumpfilter.h"
+#include "charbuffer.h"
+#include "hash.h"
+#include "matcher.h"
+#include "memory.h"
+
+#include <ctype.h>
+#include <string.h>
+
+// The initial size of the linear copy of a chunk.
+#define DUMPFILTER_DATA_SIZE (64 * 1024)
+
+struct dumpfilter_query {
+    matcher_t* matcher;
+    bool compiled;
+};
+
+struct dumpfilter {
+    dumpfilter_options_t options;
+    const matcher_t* matcher;
+    matcher_result_t* hits;
+    dumpfilter_match_fn callback;
+    void* user;
+
+    charbuffer_t* printable;
+    charbuffer_t* unprintable;
+    charbuffer_t* printableOpt;
+    charbuffer_t* unprintableOpt;
+    uint64_t printableCount;
+    uint64_t unprintableCount;
+
+    // The offset after the last character appended to the printable
+    // buffer. The chunk covers all bytes up to this offset.
+    uint64_t chunkEnd;
+
+    // The maximum chunk size that was printable, added to the complete
+    // printable buffer.
+    uint64_t maxChunkSize;
+    uint64_t currChunkSize;
+    bool prevPrintable;
+
+    // The position of the next byte and the position after the last
+    // byte that reset the state.
+    uint64_t position;
+    uint64_t restartPosition;
+
+    // Linear copy of the chunk that is currently checked, in a block of
+    // *dataSize* bytes from `allocate_pages()`.
+    char* data;
+    uint64_t dataSize;
+
+    // Reset positions are marked in this bitmap, see `dumpfilter_track()`.
+    uint64_t* trackBits;
+    uint64_t trackStart;
+    uint64_t trackSize;
+};
+
+dumpfilter_query_t* dumpfilter_query_alloc(void) {
+    dumpfilter_query_t* query = allocate(sizeof(dumpfilter_query_t));
+    if (!query) {
+        return NULL;
+    }
+    query->matcher = matcher_alloc();
+    if (!query->matcher) {
+        deallocate(query);
+        return NULL;
+    }
+    query->compiled = false;
+    return query;
+}
+
+void dumpfilter_query_free(dumpfilter_query_t* query) {
+    matcher_free(query->matcher);
+    deallocate(query);
+}
+
+bool dumpfilter_query_add(dumpfilter_query_t* query, const char* term,
+                          size_t length) {
+    if (query->compiled) {
+        return false;
+    }
+    return matcher_add(query->matcher, term, length);
+}
+
+bool dumpfilter_query_add_file(dumpfilter_query_t* query, const char* path,
+                               size_t* outCount) {
+    if (query->compiled) {
+        return false;
+    }
+    return matcher_add_file(query->matcher, path, outCount);
+}
+
+size_t dumpfilter_query_count(const dumpfilter_query_t* query) {
+    return matcher_count(query->matcher);
+}
+
+bool dumpfilter_query_compile(dumpfilter_query_t* query) {
+    if (!query->compiled) {
+        query->compiled = matcher_compile(query->matcher);
+    }
+    return query->compiled;
+}
+
+uint64_t dumpfilter_query_hash(const dumpfilter_query_t* query) {
+    uint64_t hash = matcher_count(query->matcher);
+    uint32_t i;
+    for (i=0; i < matcher_count(query->matcher); i++) {
+        size_t length;
+        const char* term = matcher_term(query->matcher, i, &length);
+        hash = hash64(term, length, hash + length);
+    }
+    return hash;
+}
+
+void dumpfilter_options_init(dumpfilter_options_t* options) {
+    memset(options, 0, sizeof(dumpfilter_options_t));
+    options->whitespacePrintable = true;
+    options->bufSize = 1024;
+}
+
+bool dumpfilter_is_printable(const dumpfilter_options_t* options, int c) {
+    if (options->whitespacePrintable) {
+        switch (c) {
+            case '\n':
+            case '\r':
+            case '\t':
+            case ' ':
+                return true;
+        }
+    }
+    return isprint(c);
+}
+
+dumpfilter_t* dumpfilter_alloc(const dumpfilter_query_t* query,
+                               const dumpfilter_options_t* options,
+                               dumpfilter_match_fn callback, void* user) {
+    if (!query->compiled || options->bufSize == 0) {
+        return NULL;
+    }
+    dumpfilter_t* scanner = allocate(sizeof(dumpfilter_t));
+    if (!scanner) {
+        return NULL;
+    }
+    memset(scanner, 0, sizeof(dumpfilter_t));
+    scanner->options = *options;
+    scanner->matcher = query->matcher;
+    scanner->callback = callback;
+    scanner->hits = matcher_result_alloc(scanner->matcher);
+    scanner->printable = charbuffer_alloc(options->bufSize);
+    scanner->unprintable = charbuffer_alloc(options->bufSize);
+    if (!scanner->hits || !scanner->printable || !scanner->unprintable) {
+        dumpfilter_free(scanner);
+        return NULL;
+    }
+    dumpfilter_reset(scanner, 0, user);
+    return scanner;
+}
+
+void dumpfilter_free(dumpfilter_t* scanner) {
+    if (scanner->hits) {
+        matcher_result_free(scanner->hits);
+    }
+    if (scanner->printable) {
+        charbuffer_free(scanner->printable);
+    }
+    if (scanner->unprintable) {
+        charbuffer_free(scanner->unprintable);
+    }
+    deallocate_pages(scanner->data, scanner->dataSize);
+    deallocate(scanner);
+}
+
+void dumpfilter_reset(dumpfilter_t* scanner, uint64_t position, void* user) {
+    charbuffer_flush(scanner->printable);
+    charbuffer_flush(scanner->unprintable);
+    scanner->printableOpt = scanner->printable;
+    scanner->unprintableOpt = scanner->unprintable;
+    scanner->printableCount = 0;
+    scanner->unprintableCount = 0;
+    scanner->chunkEnd = 0;
+    scanner->maxChunkSize = 0;
+    scanner->currChunkSize = 0;
+    scanner->prevPrintable = false;
+    scanner->position = position;
+    scanner->restartPosition = position;
+    scanner->user = user;
+    scanner->trackBits = NULL;
+    scanner->trackStart = 0;
+    scanner->trackSize = 0;
+}
+
+void dumpfilter_track(dumpfilter_t* scanner, uint64_t* bits, uint64_t start,
+                      uint64_t size) {
+    scanner->trackBits = bits;
+    scanner->trackStart = start;
+    scanner->trackSize = size;
+}
+
+uint64_t dumpfilter_position(const dumpfilter_t* scanner) {
+    return scanner->position;
+}
+
+uint64_t dumpfilter_restart_position(const dumpfilter_t* scanner) {
+    return scanner->restartPosition;
+}
+
+/**
+ * Check the chunk in the printable buffer that was ended by the byte at
+ * *offset* for the search terms and report it if any was found.
+ */
+static bool dumpfilter_check(dumpfilter_t* scanner, uint64_t offset) {
+    uint64_t length = charbuffer_length(scanner->printable);
+    if (length + 1 > scanner->dataSize) {
+        // Grow in powers of two, large chunks end up on huge pages.
+        uint64_t size = DUMPFILTER_DATA_SIZE;
+        while (size < length + 1) {
+            size *= 2;
+        }
+        deallocate_pages(scanner->data, scanner->dataSize);
+        scanner->data = allocate_pages(size);
+        if (!scanner->data) {
+            scanner->dataSize = 0;
+            return false;
+        }
+        scanner->dataSize = size;
+    }
+    charbuffer_to_buffer(scanner->printable, scanner->data, length);
+
+    size_t hitCount = matcher_scan(scanner->matcher, scanner->hits,
+                                   scanner->data, length,
+                                   scanner->options.firstOnly);
+    if (hitCount == 0) {
+        return true;
+    }
+
+    dumpfilter_match_t match;
+    match.offset = offset;
+    match.end = scanner->chunkEnd;
+    match.start = match.end - length;
+    match.longestRun = scanner->maxChunkSize;
+    match.data = scanner->data;
+    match.length = length;
+    match.hits = scanner->hits->hits;
+    match.hitCount = hitCount;
+
+    size_t i;
+    for (i=0; i < hitCount; i++) {
+        scanner->hits->hits[i].offset += match.start;
+    }
+    return scanner->callback(scanner->user, &match);
+}
+
+/**
+ * Report the chunk that was ended by the byte at *position* if it
+ * fulfills the criteria, and reset the state.
+ */
+static bool dumpfilter_end_chunk(dumpfilter_t* scanner, uint64_t position) {
+    const dumpfilter_options_t* options = &scanner->options;
+    if (scanner->currChunkSize > scanner->maxChunkSize) {
+        scanner->maxChunkSize = scanner->currChunkSize;
+    }
+
+    bool accepted = options->resultMaxSize == 0;
+    accepted |= scanner->printableCount <= options->resultMaxSize;
+    accepted &= scanner->maxChunkSize >= options->minChunkSize;
+    bool result = true;
+    if (accepted) {
+        result = dumpfilter_check(scanner, position);
+    }
+
+    charbuffer_flush(scanner->printable);
+    charbuffer_flush(scanner->unprintable);
+    scanner->printableCount = 0;
+    scanner->unprintableCount = 0;
+    scanner->printableOpt = scanner->printable;
+    scanner->unprintableOpt = scanner->unprintable;
+    scanner->maxChunkSize = 0;
+    scanner->currChunkSize = 0;
+    return result;
+}
+
+bool dumpfilter_feed(dumpfilter_t* scanner, const void* buffer, size_t size) {
+    const dumpfilter_options_t* options = &scanner->options;
+    const char* data = buffer;
+    size_t i;
+    for (i=0; i < size; i++) {
+        bool isPrintable = dumpfilter_is_printable(options, data[i]);
+        if (isPrintable && (options->resultMaxSize == 0 ||
+                scanner->printableCount <= options->resultMaxSize)) {
+            if (!scanner->prevPrintable) {
+                scanner->currChunkSize = 0;
+            }
+
+            // Append the unprintable characters since they are
+            // allowed due to `unprintablesAllowed`. The nodes before
+            // the last filled one are full, start from there.
+            scanner->printableOpt = charbuffer_append_charbuffer(
+                    scanner->printableOpt, scanner->unprintable, 0);
+            charbuffer_flush(scanner->unprintable);
+            scanner->unprintableOpt = scanner->unprintable;
+            scanner->unprintableCount = 0;
+
+            // Append the current character.
+            if (scanner->printableOpt) {
+                scanner->printableOpt = charbuffer_append_char(
+                        scanner->printableOpt, data[i]);
+            }
+            if (!scanner->printableOpt) {
+                return false;
+            }
+            scanner->printableCount++;
+            scanner->chunkEnd = scanner->position + i + 1;
+            scanner->currChunkSize++;
+        }
+        else if (scanner->unprintableCount > options->unprintablesAllowed) {
+            // The number of unprintable character was exceeded.
+            uint64_t position = scanner->position + i;
+            if (!dumpfilter_end_chunk(scanner, position)) {
+                scanner->position = position + 1;
+                return false;
+            }
+            scanner->restartPosition = position + 1;
+
+            if (scanner->trackBits && position >= scanner->trackStart &&
+                    position - scanner->trackStart < scanner->trackSize) {
+                uint64_t bit = position - scanner->trackStart;
+                scanner->trackBits[bit / 64] |= (uint64_t) 1 << (bit % 64);
+            }
+        }
+        else {
+            scanner->unprintableOpt = charbuffer_append_char(
+                    scanner->unprintableOpt, data[i]);
+            if (!scanner->unprintableOpt) {
+                return false;
+            }
+            scanner->unprintableCount++;
+        }
+        scanner->prevPrintable = isPrintable;
+    }
+    scanner->position += size;
+    return true;
+}
+
+bool dumpfilter_finish(dumpfilter_t* scanner) {
+    // An empty chunk at the end of the stream is not reported.
+    bool result = true;
+    if (scanner->printableCount > 0) {
+        result = dumpfilter_end_chunk(scanner, scanner->position);
+    }
+    dumpfilter_reset(scanner, scanner->position, scanner->user);
+    return result;
+}
@@ -0,0 +1,251 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef DUMPFILTER_H__
+#define DUMPFILTER_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+
+    /**
+     * libdumpfilter finds chunks of printable characters in a stream
+     * of bytes that contain one of a set of search terms. The terms
+     * are compiled once into a query that can be shared by any number
+     * of scanners, also across threads. A scanner is fed the stream in
+     * blocks of any size and reports every matching chunk to a
+     * callback. There is no global state, every scanner must only be
+     * used by one thread at a time.
+     *
+     *     dumpfilter_query_t* query = dumpfilter_query_alloc();
+     *     dumpfilter_query_add(query, "secret", 6);
+     *     dumpfilter_query_compile(query);
+     *
+     *     dumpfilter_options_t options;
+     *     dumpfilter_options_init(&options);
+     *     dumpfilter_t* scanner = dumpfilter_alloc(query, &options,
+     *                                              on_match, user);
+     *     while ((size = read(fd, buffer, sizeof(buffer))) > 0) {
+     *         dumpfilter_feed(scanner, buffer, size);
+     *     }
+     *     dumpfilter_finish(scanner);
+     */
+
+    /**
+     * A compiled set of search terms. Terms are identified by the order
+     * in which they have been added, starting at zero.
+     */
+    struct dumpfilter_query;
+
+    typedef struct dumpfilter_query dumpfilter_query_t;
+
+    /**
+     * The criteria for the chunks of printable characters.
+     */
+    struct dumpfilter_options {
+        // The number of unprintable bytes allowed between two printable
+        // sections of the same chunk. Default is zero.
+        uint64_t unprintablesAllowed;
+
+        // The maximum size of a chunk, zero for no maximum (default).
+        uint64_t resultMaxSize;
+
+        // The minimum size of the longest printable run of a chunk.
+        // Default is zero.
+        uint64_t minChunkSize;
+
+        // Treat whitespace characters as printable. Default is true.
+        bool whitespacePrintable;
+
+        // Report only the first hit if the caller just needs to know
+        // whether a chunk matches. Default is false.
+        bool firstOnly;
+
+        // The node size of the internal character buffers. Default is
+        // 1024.
+        size_t bufSize;
+    };
+
+    typedef struct dumpfilter_options dumpfilter_options_t;
+
+    /**
+     * The first occurence of a search term in a chunk.
+     */
+    struct dumpfilter_hit {
+        uint32_t term;
+        uint64_t offset;
+    };
+
+    typedef struct dumpfilter_hit dumpfilter_hit_t;
+
+    /**
+     * A chunk that contains at least one of the search terms. All
+     * offsets are absolute positions in the stream.
+     */
+    struct dumpfilter_match {
+        // The position of the byte that ended the chunk, or the end of
+        // the stream for the last chunk.
+        uint64_t offset;
+
+        // The range of bytes covered by the chunk.
+        uint64_t start;
+        uint64_t end;
+
+        // The longest run of printable characters in the chunk.
+        uint64_t longestRun;
+
+        const char* data;
+        uint64_t length;
+
+        const dumpfilter_hit_t* hits;
+        size_t hitCount;
+    };
+
+    typedef struct dumpfilter_match dumpfilter_match_t;
+
+    /**
+     * Called for every matching chunk. The data and hits are only
+     * valid during the call. Returning false stops the scanner.
+     */
+    typedef bool (*dumpfilter_match_fn)(void* user,
+                                        const dumpfilter_match_t* match);
+
+    /**
+     * The context of a scan.
+     *
+     * The state of a scanner is reset whenever too many unprintable
+     * bytes follow each other. From such a reset position on, the
+     * results do not depend on the bytes before, which is what allows
+     * scanning parts of a stream independently (see
+     * `dumpfilter_track()`).
+     */
+    struct dumpfilter;
+
+    typedef struct dumpfilter dumpfilter_t;
+
+    /**
+     * Allocate an empty query. Returns NULL on failure.
+     */
+    dumpfilter_query_t* dumpfilter_query_alloc(void);
+
+    /**
+     * Free the query. All scanners using it must be freed before.
+     */
+    void dumpfilter_query_free(dumpfilter_query_t* query);
+
+    /**
+     * Add a search term. Returns false on failure or if the query was
+     * already compiled.
+     */
+    bool dumpfilter_query_add(dumpfilter_query_t* query, const char* term,
+                              size_t length);
+
+    /**
+     * Add the terms from a file, one per line. Empty lines are skipped.
+     * The number of terms added is assigned to *outCount* if it is not
+     * NULL. Returns false if the file could not be read.
+     */
+    bool dumpfilter_query_add_file(dumpfilter_query_t* query,
+                                   const char* path, size_t* outCount);
+
+    /**
+     * Returns the number of terms in the query.
+     */
+    size_t dumpfilter_query_count(const dumpfilter_query_t* query);
+
+    /**
+     * Compile the query. It can not be modified afterwards. Returns
+     * false on failure.
+     */
+    bool dumpfilter_query_compile(dumpfilter_query_t* query);
+
+    /**
+     * Returns a hash of all terms of the query, for example to check
+     * that a scan is continued with the same terms.
+     */
+    uint64_t dumpfilter_query_hash(const dumpfilter_query_t* query);
+
+    /**
+     * Fill *options* with the default values.
+     */
+    void dumpfilter_options_init(dumpfilter_options_t* options);
+
+    /**
+     * Returns true if *c* is a printable character with *options*.
+     */
+    bool dumpfilter_is_printable(const dumpfilter_options_t* options, int c);
+
+    /**
+     * Allocate a scanner for the compiled *query* that reports the
+     * matching chunks to *callback*. Returns NULL on failure.
+     */
+    dumpfilter_t* dumpfilter_alloc(const dumpfilter_query_t* query,
+                                   const dumpfilter_options_t* options,
+                                   dumpfilter_match_fn callback, void* user);
+
+    /**
+     * Free the scanner.
+     */
+    void dumpfilter_free(dumpfilter_t* scanner);
+
+    /**
+     * Discard the current chunk and continue as if a new stream started
+     * at *position*, reporting to *user*. Also stops tracking reset
+     * positions.
+     */
+    void dumpfilter_reset(dumpfilter_t* scanner, uint64_t position,
+                          void* user);
+
+    /**
+     * Mark the positions at which the state is reset in the bitmap
+     * *bits* for the *size* bytes starting at *start*. The bitmap must
+     * be cleared by the caller.
+     */
+    void dumpfilter_track(dumpfilter_t* scanner, uint64_t* bits,
+                          uint64_t start, uint64_t size);
+
+    /**
+     * Returns the position of the next byte that will be fed.
+     */
+    uint64_t dumpfilter_position(const dumpfilter_t* scanner);
+
+    /**
+     * Returns the position after the last byte at which the state was
+     * reset. All matches before it have been reported, and a scanner
+     * that is reset to it reports the same matches from then on as
+     * this one. Scans can be interrupted and continued from there.
+     */
+    uint64_t dumpfilter_restart_position(const dumpfilter_t* scanner);
+
+    /**
+     * Process the next *size* bytes of the stream. Returns false if
+     * memory could not be allocated or the callback stopped the scan.
+     */
+    bool dumpfilter_feed(dumpfilter_t* scanner, const void* data,
+                         size_t size);
+
+    /**
+     * Report the chunk at the end of the stream, if any, and reset the
+     * scanner to continue at the same position. Returns false if memory
+     * could not be allocated or the callback stopped the scan.
+     */
+    bool dumpfilter_finish(dumpfilter_t* scanner);
+
+#endif /* DUMPFILTER_H__ */
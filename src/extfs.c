@@ -0,0 +1,457 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "extfs.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+// Fields of the superblock.
+#define SB_BLOCKS_COUNT 0x04
+#define SB_FIRST_DATA_BLOCK 0x14
+#define SB_LOG_BLOCK_SIZE 0x18
+#define SB_LOG_CLUSTER_SIZE 0x1C
+#define SB_BLOCKS_PER_GROUP 0x20
+#define SB_CLUSTERS_PER_GROUP 0x24
+#define SB_INODES_PER_GROUP 0x28
+#define SB_MAGIC 0x38
+#define SB_REV_LEVEL 0x4C
+#define SB_INODE_SIZE 0x58
+#define SB_FEATURE_COMPAT 0x5C
+#define SB_FEATURE_INCOMPAT 0x60
+#define SB_FEATURE_RO_COMPAT 0x64
+#define SB_RESERVED_GDT_BLOCKS 0xCE
+#define SB_DESC_SIZE 0xFE
+#define SB_FIRST_META_BG 0x104
+#define SB_BLOCKS_COUNT_HI 0x150
+#define SB_BACKUP_BGS 0x24C
+#define SB_SIZE 1024
+
+#define COMPAT_SPARSE_SUPER2 0x200
+#define INCOMPAT_META_BG 0x10
+#define INCOMPAT_64BIT 0x80
+#define RO_COMPAT_SPARSE_SUPER 0x1
+#define RO_COMPAT_GDT_CSUM 0x10
+#define RO_COMPAT_BIGALLOC 0x200
+#define RO_COMPAT_METADATA_CSUM 0x400
+
+// Fields of a group descriptor.
+#define BG_BLOCK_BITMAP 0x00
+#define BG_INODE_BITMAP 0x04
+#define BG_INODE_TABLE 0x08
+#define BG_FLAGS 0x12
+#define BG_BLOCK_BITMAP_HI 0x20
+#define BG_INODE_BITMAP_HI 0x24
+#define BG_INODE_TABLE_HI 0x28
+#define BG_BLOCK_UNINIT 0x2
+
+static uint32_t read_le(const unsigned char* bytes, size_t count) {
+    uint32_t value = 0;
+    while (count-- > 0) {
+        value = (value << 8) | bytes[count];
+    }
+    return value;
+}
+
+static bool read_at(int fd, void* buffer, size_t size, uint64_t offset) {
+    size_t filled = 0;
+    while (filled < size) {
+        ssize_t bytes = pread(fd, (char*) buffer + filled, size - filled, offset + filled);
+        if (bytes < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytes <= 0) {
+            if (bytes == 0) {
+                errno = EIO;
+            }
+            return false;
+        }
+        filled += bytes;
+    }
+    return true;
+}
+
+/**
+ * Returns true if *value* is a power of *base*.
+ */
+static bool is_power(uint64_t value, uint64_t base) {
+    while (value > 1 && value % base == 0) {
+        value /= base;
+    }
+    return value == 1;
+}
+
+/**
+ * The parameters of the file system that locate the group descriptors.
+ */
+struct extfs_layout {
+    const unsigned char* sb;
+    uint64_t blockSize;
+    uint64_t firstDataBlock;
+    uint64_t blocksPerGroup;
+    uint64_t groupCount;
+
+    // With bigalloc, the bitmaps have a bit for every cluster of
+    // *clusterBlocks* blocks.
+    uint64_t clusterBlocks;
+    uint64_t clustersPerGroup;
+    uint64_t descPerBlock;
+    uint64_t firstMetaBg;
+    size_t descSize;
+    uint64_t inodeTableBlocks;
+    uint32_t compat;
+    uint32_t incompat;
+    uint32_t roCompat;
+};
+
+/**
+ * Returns true if the group contains a copy of the superblock.
+ */
+static bool group_has_super(const struct extfs_layout* layout, uint64_t group) {
+    if (group == 0) {
+        return true;
+    }
+    if (layout->compat & COMPAT_SPARSE_SUPER2) {
+        return group == read_le(layout->sb + SB_BACKUP_BGS, 4) ||
+                group == read_le(layout->sb + SB_BACKUP_BGS + 4, 4);
+    }
+    if (group <= 1 || !(layout->roCompat & RO_COMPAT_SPARSE_SUPER)) {
+        return true;
+    }
+    if (group % 2 == 0) {
+        return false;
+    }
+    return is_power(group, 3) || is_power(group, 5) || is_power(group, 7);
+}
+
+/**
+ * Returns the number of blocks at the start of the group up to and
+ * including its copy of the superblock. With 1K blocks, the first group
+ * can start with the boot block (bigalloc).
+ */
+static uint64_t group_super_blocks(const struct extfs_layout* layout, uint64_t group) {
+    if (!group_has_super(layout, group)) {
+        return 0;
+    }
+    if (group == 0 && layout->firstDataBlock == 0 && layout->blockSize == 1024) {
+        return 2;
+    }
+    return 1;
+}
+
+/**
+ * Returns the number of blocks with group descriptors in the group.
+ */
+static uint64_t group_desc_blocks(const struct extfs_layout* layout, uint64_t group) {
+    uint64_t metaGroup = group / layout->descPerBlock;
+    if (!(layout->incompat & INCOMPAT_META_BG) || metaGroup < layout->firstMetaBg) {
+        if (!group_has_super(layout, group)) {
+            return 0;
+        }
+        if (layout->incompat & INCOMPAT_META_BG) {
+            return layout->firstMetaBg;
+        }
+        return (layout->groupCount + layout->descPerBlock - 1) / layout->descPerBlock;
+    }
+    // The first, second and last group of a meta group have a copy.
+    uint64_t index = group % layout->descPerBlock;
+    return index == 0 || index == 1 || index == layout->descPerBlock - 1 ? 1 : 0;
+}
+
+/**
+ * Read a block number from a group descriptor, with the high half if
+ * descriptors are large enough.
+ */
+static uint64_t desc_block(const struct extfs_layout* layout, const unsigned char* desc,
+                           size_t lo, size_t hi) {
+    uint64_t block = read_le(desc + lo, 4);
+    if (layout->descSize >= 64) {
+        block |= (uint64_t) read_le(desc + hi, 4) << 32;
+    }
+    return block;
+}
+
+/**
+ * Mark the clusters of the blocks [*start*, *start* + *length*) in the
+ * *bitmap* of the *count* clusters from block *first* on.
+ */
+static void mark_used(const struct extfs_layout* layout, unsigned char* bitmap,
+                      uint64_t first, uint64_t count, uint64_t start, uint64_t length) {
+    uint64_t block;
+    for (block=start; block < start + length; block++) {
+        if (block < first) {
+            continue;
+        }
+        uint64_t cluster = (block - first) / layout->clusterBlocks;
+        if (cluster < count) {
+            bitmap[cluster / 8] |= 1 << (cluster % 8);
+        }
+    }
+}
+
+/**
+ * Build the bitmap of a group whose bitmap was never initialized, in
+ * which only the metadata of the file system is in use. This is what
+ * the kernel does when it first allocates in the group.
+ */
+static void uninit_bitmap(const struct extfs_layout* layout, uint64_t group,
+                          const unsigned char* desc, uint64_t first, uint64_t count,
+                          unsigned char* bitmap) {
+    memset(bitmap, 0, layout->blockSize);
+    uint64_t meta = group_super_blocks(layout, group);
+    meta += group_desc_blocks(layout, group);
+    if (meta > 0 && (!(layout->incompat & INCOMPAT_META_BG) ||
+                     group / layout->descPerBlock < layout->firstMetaBg)) {
+        meta += read_le(layout->sb + SB_RESERVED_GDT_BLOCKS, 2);
+    }
+    mark_used(layout, bitmap, first, count, first, meta);
+
+    // With flex_bg, the bitmaps and inode tables are usually in other
+    // groups.
+    mark_used(layout, bitmap, first, count,
+              desc_block(layout, desc, BG_BLOCK_BITMAP, BG_BLOCK_BITMAP_HI), 1);
+    mark_used(layout, bitmap, first, count,
+              desc_block(layout, desc, BG_INODE_BITMAP, BG_INODE_BITMAP_HI), 1);
+    mark_used(layout, bitmap, first, count,
+              desc_block(layout, desc, BG_INODE_TABLE, BG_INODE_TABLE_HI),
+              layout->inodeTableBlocks);
+}
+
+/**
+ * Add the blocks [*start*, *end*) to the free space, merging them with
+ * the last extent if they are adjacent.
+ */
+static bool add_extent(extfs_free_t* space, size_t* capacity, uint64_t offset,
+                       uint64_t start, uint64_t end) {
+    // The last cluster can extend beyond the end of the file system.
+    if (end > space->blockCount) {
+        end = space->blockCount;
+    }
+    uint64_t from = offset + start * space->blockSize;
+    uint64_t to = offset + end * space->blockSize;
+    space->freeBlocks += end - start;
+    if (space->extentCount > 0 && space->extents[space->extentCount - 1].end == from) {
+        space->extents[space->extentCount - 1].end = to;
+        return true;
+    }
+    if (space->extentCount == *capacity) {
+        size_t larger = *capacity ? *capacity * 2 : 1024;
+        extfs_extent_t* extents = reallocate(space->extents, sizeof(extfs_extent_t) * larger);
+        if (!extents) {
+            return false;
+        }
+        space->extents = extents;
+        *capacity = larger;
+    }
+    space->extents[space->extentCount].start = from;
+    space->extents[space->extentCount].end = to;
+    space->extentCount++;
+    return true;
+}
+
+/**
+ * Add the free blocks of a group, starting with block *first*, from its
+ * *bitmap* of *count* bits. A set bit marks a used cluster of
+ * *clusterBlocks* blocks.
+ */
+static bool add_group(extfs_free_t* space, size_t* capacity, uint64_t offset,
+                      uint64_t first, const unsigned char* bitmap, uint64_t count,
+                      uint64_t clusterBlocks) {
+    uint64_t runStart = 0;
+    bool inRun = false;
+    uint64_t i = 0;
+    while (i < count) {
+        // Skip whole bytes that are all used or all free.
+        if (i % 8 == 0 && i + 8 <= count &&
+                bitmap[i / 8] == (inRun ? 0x00 : 0xFF)) {
+            i += 8;
+            continue;
+        }
+        bool used = bitmap[i / 8] & (1 << (i % 8));
+        if (!used && !inRun) {
+            runStart = i;
+            inRun = true;
+        }
+        else if (used && inRun) {
+            if (!add_extent(space, capacity, offset, first + runStart * clusterBlocks,
+                            first + i * clusterBlocks)) {
+                return false;
+            }
+            inRun = false;
+        }
+        i++;
+    }
+    if (inRun) {
+        return add_extent(space, capacity, offset, first + runStart * clusterBlocks,
+                          first + count * clusterBlocks);
+    }
+    return true;
+}
+
+extfs_free_t* extfs_read_free(int fd, uint64_t offset) {
+    unsigned char sb[SB_SIZE];
+    if (!read_at(fd, sb, sizeof(sb), offset + EXTFS_SUPERBLOCK_OFFSET)) {
+        return NULL;
+    }
+    struct extfs_layout layout;
+    layout.sb = sb;
+    layout.compat = read_le(sb + SB_FEATURE_COMPAT, 4);
+    layout.incompat = read_le(sb + SB_FEATURE_INCOMPAT, 4);
+    layout.roCompat = read_le(sb + SB_FEATURE_RO_COMPAT, 4);
+    layout.firstDataBlock = read_le(sb + SB_FIRST_DATA_BLOCK, 4);
+    layout.blocksPerGroup = read_le(sb + SB_BLOCKS_PER_GROUP, 4);
+    uint32_t logBlockSize = read_le(sb + SB_LOG_BLOCK_SIZE, 4);
+    uint64_t blockCount = read_le(sb + SB_BLOCKS_COUNT, 4);
+    layout.descSize = 32;
+    if (layout.incompat & INCOMPAT_64BIT) {
+        blockCount |= (uint64_t) read_le(sb + SB_BLOCKS_COUNT_HI, 4) << 32;
+        layout.descSize = read_le(sb + SB_DESC_SIZE, 2);
+    }
+    size_t descSize = layout.descSize;
+    uint64_t inodeSize = 128;
+    if (read_le(sb + SB_REV_LEVEL, 4) > 0) {
+        inodeSize = read_le(sb + SB_INODE_SIZE, 2);
+    }
+    if (read_le(sb + SB_MAGIC, 2) != EXTFS_MAGIC || logBlockSize > 6) {
+        errno = EINVAL;
+        return NULL;
+    }
+    layout.blockSize = 1024 << logBlockSize;
+    layout.clusterBlocks = 1;
+    layout.clustersPerGroup = layout.blocksPerGroup;
+    if (layout.roCompat & RO_COMPAT_BIGALLOC) {
+        uint32_t logClusterSize = read_le(sb + SB_LOG_CLUSTER_SIZE, 4);
+        if (logClusterSize < logBlockSize || logClusterSize - logBlockSize > 16) {
+            errno = EINVAL;
+            return NULL;
+        }
+        layout.clusterBlocks = (uint64_t) 1 << (logClusterSize - logBlockSize);
+        layout.clustersPerGroup = read_le(sb + SB_CLUSTERS_PER_GROUP, 4);
+        if (layout.blocksPerGroup != layout.clustersPerGroup * layout.clusterBlocks) {
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+    if (layout.clustersPerGroup == 0 || layout.clustersPerGroup > layout.blockSize * 8 ||
+            blockCount <= layout.firstDataBlock || descSize < 32 ||
+            descSize > layout.blockSize || (descSize & (descSize - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    uint64_t groupCount = (blockCount - layout.firstDataBlock + layout.blocksPerGroup - 1) /
+            layout.blocksPerGroup;
+    uint64_t descPerBlock = layout.blockSize / descSize;
+    uint64_t firstMetaBg = read_le(sb + SB_FIRST_META_BG, 4);
+    layout.groupCount = groupCount;
+    layout.descPerBlock = descPerBlock;
+    layout.firstMetaBg = firstMetaBg;
+    layout.inodeTableBlocks = (read_le(sb + SB_INODES_PER_GROUP, 4) * inodeSize +
+                               layout.blockSize - 1) / layout.blockSize;
+    bool uninitFlags = layout.roCompat & (RO_COMPAT_GDT_CSUM | RO_COMPAT_METADATA_CSUM);
+
+    extfs_free_t* space = allocate(sizeof(extfs_free_t));
+    unsigned char* descs = allocate(layout.blockSize);
+    unsigned char* bitmap = allocate(layout.blockSize);
+    if (!space || !descs || !bitmap) {
+        if (space) {
+            deallocate(space);
+        }
+        if (descs) {
+            deallocate(descs);
+        }
+        if (bitmap) {
+            deallocate(bitmap);
+        }
+        return NULL;
+    }
+    memset(space, 0, sizeof(extfs_free_t));
+    space->blockSize = layout.blockSize;
+    space->blockCount = blockCount;
+
+    // The descriptors are read a block at a time. Without meta_bg they
+    // follow the superblock, with it every meta group of descPerBlock
+    // groups starts with the block of its descriptors.
+    size_t capacity = 0;
+    bool result = true;
+    uint64_t descBlock = UINT64_MAX;
+    uint64_t group;
+    for (group=0; group < groupCount && result; group++) {
+        uint64_t metaGroup = group / descPerBlock;
+        uint64_t block;
+        if (!(layout.incompat & INCOMPAT_META_BG) || metaGroup < firstMetaBg) {
+            block = layout.firstDataBlock + group_super_blocks(&layout, 0) + metaGroup;
+        }
+        else {
+            uint64_t metaFirst = metaGroup * descPerBlock;
+            block = layout.firstDataBlock + metaFirst * layout.blocksPerGroup +
+                    group_super_blocks(&layout, metaFirst);
+        }
+        if (block != descBlock) {
+            result = read_at(fd, descs, layout.blockSize, offset + block * layout.blockSize);
+            descBlock = block;
+            if (!result) {
+                break;
+            }
+        }
+
+        const unsigned char* desc = descs + (group % descPerBlock) * descSize;
+        uint64_t first = layout.firstDataBlock + group * layout.blocksPerGroup;
+        uint64_t count = layout.clustersPerGroup;
+        if (first + count * layout.clusterBlocks > blockCount) {
+            count = (blockCount - first + layout.clusterBlocks - 1) / layout.clusterBlocks;
+        }
+
+        // A group whose bitmap was never initialized has never been
+        // written to, except for its own metadata.
+        if (uninitFlags && (read_le(desc + BG_FLAGS, 2) & BG_BLOCK_UNINIT)) {
+            uninit_bitmap(&layout, group, desc, first, count, bitmap);
+            result = add_group(space, &capacity, offset, first, bitmap, count,
+                               layout.clusterBlocks);
+            continue;
+        }
+        uint64_t bitmapBlock = desc_block(&layout, desc, BG_BLOCK_BITMAP, BG_BLOCK_BITMAP_HI);
+        if (bitmapBlock == 0 || bitmapBlock >= blockCount) {
+            errno = EINVAL;
+            result = false;
+            break;
+        }
+        result = read_at(fd, bitmap, layout.blockSize, offset + bitmapBlock * layout.blockSize) &&
+                add_group(space, &capacity, offset, first, bitmap, count,
+                          layout.clusterBlocks);
+    }
+
+    deallocate(descs);
+    deallocate(bitmap);
+    if (!result) {
+        extfs_free(space);
+        return NULL;
+    }
+    return space;
+}
+
+void extfs_free(extfs_free_t* space) {
+    if (space) {
+        if (space->extents) {
+            deallocate(space->extents);
+        }
+        deallocate(space);
+    }
+}
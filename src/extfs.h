@@ -0,0 +1,75 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef EXTFS_H__
+#define EXTFS_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+
+    #include "memory.h"
+
+    /**
+     * The superblock of an ext2/3/4 file system is at this offset from
+     * its start.
+     */
+    #define EXTFS_SUPERBLOCK_OFFSET 1024
+    #define EXTFS_MAGIC 0xEF53
+
+    /**
+     * A range of free blocks as absolute byte offsets in the image.
+     */
+    struct extfs_extent {
+        uint64_t start;
+        uint64_t end;
+    };
+
+    typedef struct extfs_extent extfs_extent_t;
+
+    /**
+     * The free space of an ext2/3/4 file system.
+     */
+    struct extfs_free {
+        uint64_t blockSize;
+        uint64_t blockCount;
+        uint64_t freeBlocks;
+
+        // The free blocks, sorted and with adjacent ranges merged.
+        extfs_extent_t* extents;
+        size_t extentCount;
+    };
+
+    typedef struct extfs_free extfs_free_t;
+
+    /**
+     * Read the block bitmaps of the ext2/3/4 file system at *offset* in
+     * the file *fd* and collect its free blocks. Groups whose bitmap
+     * was never initialized are free as a whole. Returns NULL on error,
+     * *errno* is EINVAL if there is no supported file system.
+     */
+    extfs_free_t* extfs_read_free(int fd, uint64_t offset);
+
+    /**
+     * Free the extents.
+     */
+    void extfs_free(extfs_free_t* space);
+
+#endif /* EXTFS_H__ */
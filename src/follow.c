@@ -0,0 +1,114 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "follow.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+follow_t* follow_alloc(int fd, const char* path, int interval) {
+    follow_t* follow = allocate(sizeof(follow_t));
+    if (!follow) {
+        return NULL;
+    }
+    if (pipe(follow->wake) != 0) {
+        deallocate(follow);
+        return NULL;
+    }
+    fcntl(follow->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(follow->wake[1], F_SETFL, O_NONBLOCK);
+    follow->fd = fd;
+    follow->interval = interval > 0 ? interval : FOLLOW_INTERVAL;
+    follow->notify = -1;
+    follow->watch = -1;
+
+    // Without inotify, the size is only polled.
+    if (path) {
+        follow->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    }
+    if (follow->notify >= 0) {
+        follow->watch = inotify_add_watch(follow->notify, path,
+                                          IN_MODIFY | IN_CLOSE_WRITE);
+        if (follow->watch < 0) {
+            close(follow->notify);
+            follow->notify = -1;
+        }
+    }
+    return follow;
+}
+
+void follow_free(follow_t* follow) {
+    if (follow) {
+        if (follow->notify >= 0) {
+            close(follow->notify);
+        }
+        close(follow->wake[0]);
+        close(follow->wake[1]);
+        deallocate(follow);
+    }
+}
+
+int follow_wait(follow_t* follow, uint64_t position) {
+    for (;;) {
+        struct pollfd fds[2];
+        fds[0].fd = follow->wake[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = follow->notify;
+        fds[1].events = POLLIN;
+        nfds_t count = follow->notify >= 0 ? 2 : 1;
+
+        // Check the stop request first, the file may grow all the time.
+        if (poll(fds, 1, 0) > 0) {
+            return 0;
+        }
+
+        struct stat st;
+        if (fstat(follow->fd, &st) != 0) {
+            return -1;
+        }
+        if ((uint64_t) st.st_size > position) {
+            return 1;
+        }
+        if ((uint64_t) st.st_size < position) {
+            errno = ERANGE;
+            return -1;
+        }
+
+        int ready = poll(fds, count, follow->interval);
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ready > 0 && (fds[1].revents & POLLIN)) {
+            // Only the wake-up matters, not the events themselves.
+            char events[4096];
+            while (read(follow->notify, events, sizeof(events)) > 0);
+        }
+    }
+}
+
+void follow_stop(follow_t* follow) {
+    char byte = 0;
+    ssize_t written = write(follow->wake[1], &byte, 1);
+    (void) written;
+}
@@ -0,0 +1,82 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef FOLLOW_H__
+#define FOLLOW_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+
+    #include "memory.h"
+
+    /**
+     * The default number of milliseconds between two checks of the file
+     * size. With inotify, this only matters for changes that are not
+     * reported, e.g. on network file systems.
+     */
+    #define FOLLOW_INTERVAL 1000
+
+    /**
+     * Waits for a file that is still being written to grow. Changes are
+     * reported by inotify if it is available, the size of the file is
+     * polled as well.
+     */
+    struct follow {
+        // The descriptor of the followed file.
+        int fd;
+
+        // The inotify instance and watch, -1 if not available.
+        int notify;
+        int watch;
+
+        // A pipe that wakes up `follow_wait()` from `follow_stop()`.
+        int wake[2];
+
+        int interval;
+    };
+
+    typedef struct follow follow_t;
+
+    /**
+     * Follow the file opened as *fd*. *path* is watched with inotify,
+     * it can be NULL to only poll the size every *interval*
+     * milliseconds. Returns NULL if the wake-up pipe can not be created.
+     */
+    follow_t* follow_alloc(int fd, const char* path, int interval);
+
+    /**
+     * Free the follower. The file descriptor is not closed.
+     */
+    void follow_free(follow_t* follow);
+
+    /**
+     * Wait until the file is larger than *position* bytes. Returns 1 if
+     * it is, 0 if `follow_stop()` was called and -1 on error. If the
+     * file became smaller than *position*, *errno* is ERANGE.
+     */
+    int follow_wait(follow_t* follow, uint64_t position);
+
+    /**
+     * Make the current and all following calls to `follow_wait()`
+     * return 0. This function can be called from a signal handler.
+     */
+    void follow_stop(follow_t* follow);
+
+#endif /* FOLLOW_H__ */
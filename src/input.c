@@ -0,0 +1,528 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "input.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>
+
+// The size pipes are enlarged to, so that the writer can run ahead of
+// the scan and every read returns a large block.
+#define INPUT_PIPE_SIZE (1024 * 1024)
+
+// The size of the blocks read from pipes and files by default.
+#define INPUT_READ_SIZE (64 * 1024)
+
+// The size of the blocks read from a decompressor.
+#define INPUT_DECOMPRESS_READ_SIZE (1024 * 1024)
+
+// The read sizes for block devices with and without rotating disks.
+#define INPUT_DISK_READ_SIZE (1024 * 1024)
+#define INPUT_FLASH_READ_SIZE (256 * 1024)
+
+// Ranges of at least this size are calibrated, by reading this many
+// bytes with each read size.
+#define INPUT_CALIBRATE_RANGE (64 * 1024 * 1024)
+#define INPUT_CALIBRATE_SIZE (4 * 1024 * 1024)
+
+// The number of read sizes the kernel is asked to read ahead.
+#define INPUT_ADVISE_BLOCKS 8
+
+// The alignment of direct reads if the device does not tell.
+#define INPUT_DIRECT_ALIGN 4096
+
+// The memory the blocks of an asynchronous reader may take together.
+#define INPUT_ASYNC_MEMORY (64 * 1024 * 1024)
+
+/**
+ * Read the first bytes of the input to detect the compression format.
+ * Seekable inputs are read without moving the file position, for others
+ * the bytes are kept for `input_read()`.
+ */
+static int input_detect(input_t* input) {
+    unsigned char magic[sizeof(input->pending)];
+    ssize_t bytes;
+    if (input->seekable) {
+        off_t offset = lseek(input->fd, 0, SEEK_CUR);
+        do {
+            bytes = pread(input->fd, magic, sizeof(magic), offset);
+        } while (bytes < 0 && errno == EINTR);
+        if (bytes < 0) {
+            return DECOMPRESS_NONE;
+        }
+    }
+    else {
+        bytes = input_read(input, input->pending, sizeof(input->pending));
+        input->position = 0;
+        if (bytes < 0) {
+            return DECOMPRESS_NONE;
+        }
+        input->pendingSize = bytes;
+        memcpy(magic, input->pending, bytes);
+    }
+    return decompress_detect(magic, bytes);
+}
+
+/**
+ * Returns 1 if the block device *dev* (or the disk of the partition)
+ * has rotating disks, 0 if it has none and -1 if this is not known.
+ */
+static int input_rotational(dev_t dev) {
+    static const char* paths[] = {
+        "/sys/dev/block/%u:%u/queue/rotational",
+        "/sys/dev/block/%u:%u/../queue/rotational"
+    };
+    size_t i;
+    for (i=0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        char path[64];
+        snprintf(path, sizeof(path), paths[i], major(dev), minor(dev));
+        FILE* fp = fopen(path, "r");
+        if (fp) {
+            int value = fgetc(fp);
+            fclose(fp);
+            if (value == '0' || value == '1') {
+                return value - '0';
+            }
+        }
+    }
+    return -1;
+}
+
+/**
+ * Returns the number of nanoseconds it takes to read
+ * `INPUT_CALIBRATE_SIZE` bytes from *offset* in blocks of *size* bytes,
+ * or zero if the reads failed or came short.
+ */
+static uint64_t input_calibrate(input_t* input, char* buffer,
+                                uint64_t offset, size_t size) {
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    size_t done;
+    for (done=0; done < INPUT_CALIBRATE_SIZE; done += size) {
+        ssize_t bytes = pread(input->fd, buffer, size, offset + done);
+        if (bytes != (ssize_t) size) {
+            return 0;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t time = (uint64_t) (end.tv_sec - begin.tv_sec) * 1000000000 +
+            end.tv_nsec - begin.tv_nsec;
+    return time > 0 ? time : 1;
+}
+
+/**
+ * Ask the kernel to read the next part of the input ahead.
+ */
+static void input_advise(input_t* input) {
+    if (input->adviseSize == 0 ||
+            input->position + input->adviseSize / 2 < input->adviseEnd) {
+        return;
+    }
+    if (input->adviseStop != 0 && input->adviseEnd >= input->adviseStop) {
+        input->adviseSize = 0;
+        return;
+    }
+    posix_fadvise(input->fd, input->adviseEnd, input->adviseSize,
+                  POSIX_FADV_WILLNEED);
+    input->adviseEnd += input->adviseSize;
+}
+
+/**
+ * Set or clear O_DIRECT on the descriptor of a direct input.
+ */
+static bool input_set_direct(input_t* input, bool on) {
+    if (input->directOn == on) {
+        return true;
+    }
+    int flags = fcntl(input->fd, F_GETFL);
+    if (flags == -1) {
+        return false;
+    }
+    flags = on ? (flags | O_DIRECT) : (flags & ~O_DIRECT);
+    if (fcntl(input->fd, F_SETFL, flags) != 0) {
+        return false;
+    }
+    input->directOn = on;
+    return true;
+}
+
+input_t* input_open(const char* path, int compression, int threads) {
+    int fd;
+    if (strcmp(path, "-") == 0) {
+        fd = STDIN_FILENO;
+    }
+    else {
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return NULL;
+        }
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int error = errno;
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        errno = error;
+        return NULL;
+    }
+
+    input_t* input = allocate(sizeof(input_t));
+    if (!input) {
+        if (fd != STDIN_FILENO) {
+            close(fd);
+        }
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    input->fd = fd;
+    input->position = 0;
+    input->pipe = S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode);
+    input->seekable = !input->pipe && lseek(fd, 0, SEEK_CUR) != -1;
+    input->readSize = INPUT_READ_SIZE;
+    input->compression = DECOMPRESS_NONE;
+    input->decompressor = NULL;
+    input->pendingSize = 0;
+    input->direct = false;
+    input->directOn = false;
+    input->align = 1;
+    input->adviseEnd = 0;
+    input->adviseStop = 0;
+    input->adviseSize = 0;
+    input->uring = NULL;
+
+    if (input->pipe) {
+        #ifdef F_SETPIPE_SZ
+            fcntl(fd, F_SETPIPE_SZ, INPUT_PIPE_SIZE);
+            int pipeSize = fcntl(fd, F_GETPIPE_SZ);
+            if (pipeSize > 0 && (size_t) pipeSize > input->readSize) {
+                input->readSize = pipeSize;
+            }
+        #endif
+    }
+
+    if (compression == DECOMPRESS_AUTO) {
+        compression = input_detect(input);
+    }
+    if (compression != DECOMPRESS_NONE) {
+        input->decompressor = decompressor_start(
+                compression, fd, input->seekable, input->pending,
+                input->pendingSize, threads);
+        if (!input->decompressor) {
+            input_close(input);
+            errno = EPROTONOSUPPORT;
+            return NULL;
+        }
+        input->compression = compression;
+        input->pendingSize = 0;
+        input->seekable = false;
+        input->readSize = INPUT_DECOMPRESS_READ_SIZE;
+    }
+    return input;
+}
+
+size_t input_tune(input_t* input, uint64_t start, uint64_t end,
+                  size_t readSize) {
+    struct stat st;
+    if (!input->seekable || input->decompressor || fstat(input->fd, &st) != 0) {
+        return input->readSize;
+    }
+
+    if (readSize == 0) {
+        // Whole blocks of the file system, but enough of them to keep
+        // the number of system calls low. Disks with rotating platters
+        // need large reads to avoid seeking between the file and the
+        // outputs.
+        readSize = INPUT_READ_SIZE;
+        if (st.st_blksize > 0 && (size_t) st.st_blksize * 16 > readSize) {
+            readSize = st.st_blksize * 16;
+        }
+        int rotational = input_rotational(S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev);
+        if (S_ISBLK(st.st_mode)) {
+            readSize = rotational == 0 ? INPUT_FLASH_READ_SIZE : INPUT_DISK_READ_SIZE;
+        }
+        else if (rotational == 1) {
+            readSize = INPUT_DISK_READ_SIZE;
+        }
+
+        // Larger reads only pay off if they are faster, which depends on
+        // the device and the cache. The first pass reads the data into
+        // the cache, so all sizes are measured alike (direct reads are
+        // never cached).
+        uint64_t size = (S_ISREG(st.st_mode) ? (uint64_t) st.st_size : 0);
+        uint64_t stop = end != 0 ? end : size;
+        uint64_t offset = start - start % input->align;
+        char* buffer = NULL;
+        if (stop > offset && stop - offset >= INPUT_CALIBRATE_RANGE) {
+            buffer = allocate_pages(INPUT_MAX_READ_SIZE);
+        }
+        if (buffer && input_calibrate(input, buffer, offset, INPUT_MAX_READ_SIZE) != 0) {
+            uint64_t best = 0;
+            size_t bestSize = readSize;
+            size_t candidate;
+            for (candidate=readSize; candidate <= INPUT_MAX_READ_SIZE; candidate *= 4) {
+                uint64_t time = input_calibrate(input, buffer, offset, candidate);
+                if (time == 0) {
+                    break;
+                }
+                // Prefer the smaller size unless the larger one is at
+                // least 10% faster.
+                if (best == 0 || time * 10 < best * 9) {
+                    best = time;
+                    bestSize = candidate;
+                }
+            }
+            readSize = bestSize;
+        }
+        deallocate_pages(buffer, INPUT_MAX_READ_SIZE);
+    }
+    if (readSize > INPUT_MAX_READ_SIZE) {
+        readSize = INPUT_MAX_READ_SIZE;
+    }
+    input->readSize = readSize;
+
+    // The page cache is bypassed with direct I/O, hints are useless.
+    if (!input->direct) {
+        posix_fadvise(input->fd, start, end > start ? end - start : 0,
+                      POSIX_FADV_SEQUENTIAL);
+        input->adviseSize = readSize * INPUT_ADVISE_BLOCKS;
+        input->adviseStop = end;
+        readahead(input->fd, start, input->adviseSize);
+        input->adviseEnd = start + input->adviseSize;
+    }
+    return readSize;
+}
+
+bool input_direct(input_t* input) {
+    if (!input->seekable || input->decompressor || input->fd == STDIN_FILENO) {
+        errno = EINVAL;
+        return false;
+    }
+    input->align = INPUT_DIRECT_ALIGN;
+    #ifdef BLKSSZGET
+        int sectorSize = 0;
+        if (ioctl(input->fd, BLKSSZGET, &sectorSize) == 0 &&
+                sectorSize > INPUT_DIRECT_ALIGN) {
+            input->align = sectorSize;
+        }
+    #endif
+    if (!input_set_direct(input, true)) {
+        input->align = 1;
+        return false;
+    }
+    input->direct = true;
+    input->adviseSize = 0;
+    return true;
+}
+
+bool input_async(input_t* input, uint64_t end, unsigned depth) {
+    if (!input->seekable || input->decompressor || input->uring ||
+            input->fd == STDIN_FILENO) {
+        errno = EINVAL;
+        return false;
+    }
+    off_t size = lseek(input->fd, 0, SEEK_END);
+    if (size == -1 || lseek(input->fd, input->position, SEEK_SET) == -1) {
+        return false;
+    }
+    if (end == 0 || end > (uint64_t) size) {
+        end = size;
+    }
+    if (end <= input->position) {
+        return true;
+    }
+
+    // Many reads in flight need smaller blocks.
+    size_t blockSize = input->readSize;
+    if (blockSize * depth > INPUT_ASYNC_MEMORY) {
+        blockSize = INPUT_ASYNC_MEMORY / depth;
+        if (blockSize < INPUT_READ_SIZE) {
+            blockSize = INPUT_READ_SIZE;
+        }
+    }
+    size_t align = input->direct ? input->align : 1;
+    blockSize -= blockSize % align;
+    if (blockSize == 0) {
+        blockSize = align;
+    }
+
+    // The reads of the ring use the flags of the descriptor.
+    if (input->direct && !input_set_direct(input, true)) {
+        input->direct = false;
+        align = 1;
+    }
+    input->uring = uring_start(input->fd, input->position, end, blockSize,
+                               align, depth);
+    if (!input->uring) {
+        return false;
+    }
+    input->adviseSize = 0;
+    return true;
+}
+
+void input_close(input_t* input) {
+    if (input) {
+        decompressor_stop(input->decompressor);
+        uring_stop(input->uring);
+        if (input->fd != STDIN_FILENO) {
+            close(input->fd);
+        }
+        deallocate(input);
+    }
+}
+
+bool input_skip(input_t* input, uint64_t count) {
+    if (count == 0) {
+        return true;
+    }
+
+    if (input->seekable) {
+        struct stat st;
+        off_t offset = lseek(input->fd, count, SEEK_CUR);
+        if (offset == -1) {
+            return false;
+        }
+        input->position += count;
+        // Seeking past the end of a regular file does not fail.
+        if (fstat(input->fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                (uint64_t) offset > (uint64_t) st.st_size) {
+            return false;
+        }
+        return true;
+    }
+
+    #ifdef SPLICE_F_MOVE
+        // Let the kernel discard the data of pipes without copying it.
+        if (input->pipe && !input->decompressor && input->pendingSize == 0) {
+            int null = open("/dev/null", O_WRONLY);
+            while (null >= 0 && count > 0) {
+                size_t size = count > INPUT_PIPE_SIZE ? INPUT_PIPE_SIZE : count;
+                ssize_t moved = splice(input->fd, NULL, null, NULL, size,
+                                       SPLICE_F_MOVE);
+                if (moved < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (moved <= 0) {
+                    break;
+                }
+                count -= moved;
+                input->position += moved;
+            }
+            if (null >= 0) {
+                close(null);
+            }
+            if (count == 0) {
+                return true;
+            }
+        }
+    #endif
+
+    char buffer[4096];
+    while (count > 0) {
+        size_t size = count > sizeof(buffer) ? sizeof(buffer) : count;
+        ssize_t bytes = input_read(input, buffer, size);
+        if (bytes <= 0) {
+            return false;
+        }
+        count -= bytes;
+    }
+    return true;
+}
+
+ssize_t input_read(input_t* input, void* buffer, size_t size) {
+    if (input->uring) {
+        ssize_t bytes = uring_read(input->uring, buffer, size);
+        if (bytes > 0) {
+            input->position += bytes;
+        }
+        return bytes;
+    }
+    if (input->decompressor) {
+        ssize_t bytes = decompressor_read(input->decompressor, buffer, size);
+        if (bytes > 0) {
+            input->position += bytes;
+        }
+        return bytes;
+    }
+
+    size_t filled = 0;
+    if (input->pendingSize > 0 && size > 0) {
+        filled = input->pendingSize < size ? input->pendingSize : size;
+        memcpy(buffer, input->pending, filled);
+        input->pendingSize -= filled;
+        memmove(input->pending, input->pending + filled, input->pendingSize);
+    }
+    while (filled < size) {
+        char* target = (char*) buffer + filled;
+        size_t count = size - filled;
+        if (input->direct) {
+            // O_DIRECT requires aligned offsets, sizes and buffers, the
+            // rest is read through the page cache up to the next aligned
+            // offset.
+            size_t offset = (input->position + filled) % input->align;
+            bool aligned = offset == 0 && count >= input->align &&
+                    (uintptr_t) target % input->align == 0;
+            if (aligned) {
+                count -= count % input->align;
+            }
+            else if (offset != 0 && count > input->align - offset) {
+                count = input->align - offset;
+            }
+            if (!input_set_direct(input, aligned)) {
+                input->direct = false;
+            }
+        }
+        ssize_t bytes = read(input->fd, target, count);
+        if (bytes < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Continue through the page cache if the file system
+            // rejects the direct read.
+            if (errno == EINVAL && input->directOn) {
+                input->direct = false;
+                if (input_set_direct(input, false)) {
+                    continue;
+                }
+            }
+            return -1;
+        }
+        if (bytes == 0) {
+            break;
+        }
+        filled += bytes;
+    }
+    input->position += filled;
+    input_advise(input);
+    return filled;
+}
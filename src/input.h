@@ -0,0 +1,146 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef INPUT_H__
+#define INPUT_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <sys/types.h>
+
+    #include "memory.h"
+    #include "decompress.h"
+    #include "uring.h"
+
+    /**
+     * The largest read size chosen by `input_tune()`.
+     */
+    #define INPUT_MAX_READ_SIZE (4 * 1024 * 1024)
+
+    /**
+     * A source of input bytes. This can be a regular file or device,
+     * or a pipe (including the standard input) that can not seek. If
+     * the data is compressed, it is decompressed on the fly and the
+     * input behaves like a pipe with the decompressed data.
+     */
+    struct input {
+        int fd;
+        bool seekable;
+        bool pipe;
+
+        // The compression format and the decompressor, if any.
+        int compression;
+        decompressor_t* decompressor;
+
+        // Bytes that have been read to detect the compression but
+        // not yet returned by `input_read()`.
+        unsigned char pending[4];
+        size_t pendingSize;
+
+        // The number of bytes consumed from the input so far.
+        uint64_t position;
+
+        // The preferred number of bytes to read at once.
+        size_t readSize;
+
+        // With direct I/O, reads of *align* bytes at aligned offsets
+        // bypass the page cache. *directOn* tells if O_DIRECT is
+        // currently set on the descriptor.
+        bool direct;
+        bool directOn;
+        size_t align;
+
+        // The page cache is asked to read the next *adviseSize* bytes
+        // from *adviseEnd* on before the scan gets there, up to
+        // *adviseStop* (zero for the end of the file).
+        uint64_t adviseEnd;
+        uint64_t adviseStop;
+        size_t adviseSize;
+
+        // The asynchronous reader, if any.
+        uring_t* uring;
+    };
+
+    typedef struct input input_t;
+
+    /**
+     * Open the file at *path* for reading. If *path* is "-", the
+     * standard input is used. *compression* is one of the
+     * `DECOMPRESS_...` formats, `DECOMPRESS_AUTO` detects the format
+     * from the first bytes. *threads* is the maximum number of threads
+     * used for decompression. Returns NULL if the file could not be
+     * opened or the format is not supported, *errno* is set
+     * accordingly.
+     */
+    input_t* input_open(const char* path, int compression, int threads);
+
+    /**
+     * Choose the read size of a seekable, uncompressed input that is
+     * read from *start* to *end* (zero for the end of the file) and
+     * tell the kernel about the sequential access. If *readSize* is
+     * zero, the size is chosen from the block size and the type of the
+     * device and verified with a short calibration read for large
+     * ranges. Returns the read size, which is also assigned to the
+     * *readSize* field. Other inputs are left unchanged.
+     */
+    size_t input_tune(input_t* input, uint64_t start, uint64_t end,
+                      size_t readSize);
+
+    /**
+     * Read the input with O_DIRECT, bypassing the page cache. This is
+     * only possible for seekable, uncompressed files other than the
+     * standard input. Unaligned parts are still read through the page
+     * cache. Returns false if the file system does not support it.
+     */
+    bool input_direct(input_t* input);
+
+    /**
+     * Read the input up to *end* (zero for the end of the file) with
+     * io_uring and *depth* reads of `readSize` bytes in flight. This is
+     * only possible for seekable, uncompressed inputs and must be done
+     * after skipping. Returns false if io_uring is not available, the
+     * input is then read synchronously.
+     */
+    bool input_async(input_t* input, uint64_t end, unsigned depth);
+
+    /**
+     * Close the input and free it.
+     */
+    void input_close(input_t* input);
+
+    /**
+     * Skip *count* bytes of the input. Seekable inputs simply move the
+     * file position, others read and discard the data. Returns false if
+     * reading failed or the input ended before *count* bytes were
+     * skipped.
+     */
+    bool input_skip(input_t* input, uint64_t count);
+
+    /**
+     * Read up to *size* bytes into *buffer*. Unlike `read()`, this
+     * function only returns less than *size* bytes at the end of the
+     * input. Returns the number of bytes read, zero at the end of the
+     * input and -1 on error. With direct I/O, *buffer* should be
+     * aligned to the page size.
+     */
+    ssize_t input_read(input_t* input, void* buffer, size_t size);
+
+#endif /* INPUT_H__ */
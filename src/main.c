@@ -18,12 +18,49 @@
  * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
  * THE SOFTWARE. */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <errno.h>
-#include <ctype.h>
-#include "charbuffer.h"
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include "carve.h"
+#include "checkpoint.h"
+#include "dedup.h"
+#include "dumpfilter.h"
+#include "extfs.h"
+#include "follow.h"
+#include "hash.h"
+#include "input.h"
+#include "output.h"
+#include "pool.h"
+#include "resindex.h"
+#include "spool.h"
+
+/**
+ * A named set of search terms. Chunks that contain at least one of its
+ * terms are written to the output file of the set. The terms of a set
+ * have consecutive indices in the query.
+ */
+struct query_set {
+    const char* name;
+    const char* termFilePath;
+    const char* outFilePath;
+    output_t* output;
+    uint32_t firstTerm;
+    uint32_t termCount;
+    bool matched;
+
+    // One more than the index of the file whose path was written last.
+    size_t headerFile;
+};
 
 struct program_args {
     char** argv;
@@ -31,6 +68,10 @@ struct program_args {
 
     char** searchTerms;
     size_t searchTermCount;
+    const char** termFilePaths;
+    size_t termFileCount;
+    struct query_set* querySets;
+    size_t querySetCount;
 
     uint64_t nUnprintablesAllowed;
     uint64_t resultMaxSize;
@@ -40,16 +81,41 @@ struct program_args {
     bool treatWhitespacesPrintable;
 
     const char* inFilePath;
+    const char** inputPaths;
+    size_t inputPathCount;
     const char* outFilePath;
-    FILE* inFile;
-    FILE* outFile;
+    const char* indexFilePath;
+    input_t* input;
+    FILE* indexFile;
+    bool indexHashes;
+    bool noText;
+    uint64_t dedupCapacity;
+    const char* checkpointPath;
+    uint64_t checkpointInterval;
+    bool resume;
+    bool follow;
+    const char* carvePath;
+    const char* extractDir;
+    uint64_t extractSize;
+    bool unallocated;
+    uint64_t fsOffset;
 
     size_t bufSize;
+    size_t readSize;
+    bool direct;
+    unsigned queueDepth;
+    int pages;
     bool verbose;
+    int compression;
+    int threads;
+    int outFormat;
+    int outLevel;
 } args = {0};
 
 int usage() {
     printf("Usage: %s [options] dumpfile search-terms\n", args.argv[0]);
+    printf("If dumpfile is -, the dump is read from the standard input. If it\n");
+    printf("is a directory, all files in it and its subdirectories are scanned.\n");
     printf(
         "Options:\n"
         "  -o <filename>        Write printable sections matching the search\n"
@@ -57,8 +123,19 @@ int usage() {
         "                       be used instead.\n"
         "  -a <bytes>           The number of unprintable bytes allowed between\n"
         "                       two printable sections.\n"
-        "  -b <bytes>           The buffer-size used internally. Default value\n"
-        "                       is 1024.\n"
+        "  -b <bytes>           The size of the blocks the chunks are collected\n"
+        "                       in. Default value is 1024.\n"
+        "  -R <bytes>           The number of bytes read from the dump file at\n"
+        "                       once. Default is to choose it from the device\n"
+        "                       and a short calibration read.\n"
+        "  -D, --direct         Read the dump file with O_DIRECT, bypassing the\n"
+        "                       page cache (for dumps that are read only once).\n"
+        "  -Q <depth>           Read the dump file with io_uring and keep this\n"
+        "                       many reads in flight. Default is 0, which\n"
+        "                       reads synchronously.\n"
+        "  -P <pages>           The pages of the read, chunk and output buffers:\n"
+        "                       normal, transparent (huge pages) or hugetlb\n"
+        "                       (reserved huge pages). Default is normal.\n"
         "  -s <bytes>           The number of bytes to skip from the beginning\n"
         "                       of the input file.\n"
         "  -m <bytes>           The maximum size of a result-chunk.If the value\n"
@@ -69,8 +146,58 @@ int usage() {
         "  -v                   Be verbose about the actual input information\n"
         "                       and stop processing afterwards.\n"
         "  -u <bytes>           Only process until this anmount of bytes have\n"
-        "                       been passed.\n"
+        "                       been passed (including the skipped bytes).\n"
         "  -w                   Do not treat whitespaces as printables.\n"
+        "  -i <filename>        Write a binary index of the accepted chunks\n"
+        "                       with their offsets and search term hits to\n"
+        "                       this file.\n"
+        "  -H                   Include a hash of the chunk contents in the\n"
+        "                       index records.\n"
+        "  -n                   Do not write the chunk text, only the index.\n"
+        "  -d <count>           Write chunks that were already written before\n"
+        "                       only as a reference to the first one. Up to\n"
+        "                       <count> different chunks are remembered.\n"
+        "  -z <format>          The compression of the dump file: auto, none,\n"
+        "                       gzip or zstd. Default is auto, which detects\n"
+        "                       the format from the first bytes and says so.\n"
+        "  -Z <format>[:<level>]\n"
+        "                       Compress the output files with gzip or zstd\n"
+        "                       (on -j threads) at the optional level.\n"
+        "  -j <threads>         The number of threads to use. Defaults to the\n"
+        "                       number of processors.\n"
+        "  -f <filename>        Read additional search terms from this file,\n"
+        "                       one per line. Can be passed multiple times.\n"
+        "  -k, --checkpoint <filename>\n"
+        "                       Write the state of the scan to this file\n"
+        "                       every -K bytes. Requires files for all\n"
+        "                       outputs. The file is removed at the end.\n"
+        "  -K <bytes>           The interval of the checkpoints. Default\n"
+        "                       is 1G (1024M).\n"
+        "  -r, --resume         Continue the scan from the checkpoint -k if\n"
+        "                       it exists. All other options and the input\n"
+        "                       files must be the same as before.\n"
+        "  -F, --follow         Do not stop at the end of the dump file but\n"
+        "                       wait for more data to be appended, until\n"
+        "                       the program is interrupted (SIGINT/SIGTERM).\n"
+        "  -C <filename>        Search the dump for the signatures of PDF, ZIP,\n"
+        "                       JPEG and SQLite files and write their offsets\n"
+        "                       to this file (- for stdout).\n"
+        "  -E <directory>[:<bytes>]\n"
+        "                       Extract up to <bytes> (default 16M) of every\n"
+        "                       file found with -C to this directory.\n"
+        "  -U, --unallocated <offset>\n"
+        "                       Scan only the free blocks of the ext2/3/4\n"
+        "                       file system at this offset of the dump file\n"
+        "                       (0 for an image of the file system).\n"
+        "  -I <path>            Scan this file or directory in addition to\n"
+        "                       dumpfile. Can be passed multiple times. The\n"
+        "                       results are grouped by file.\n"
+        "  -q <name>:<terms-file>:<out-file>\n"
+        "                       Add a query set with the search terms from\n"
+        "                       terms-file (one per line). Matching chunks\n"
+        "                       are written to out-file (- for stdout). Can\n"
+        "                       be passed multiple times, all sets are\n"
+        "                       searched in the same pass.\n"
         "\n"
         "<bytes> arguments can be a simple mathematical expression. No spaces\n"
         "are allowed and the operators are +, -, * and /. The additional\n"
@@ -89,19 +216,6 @@ int memory_error() {
     return ENOMEM;
 }
 
-bool is_printable(int i) {
-    if (args.treatWhitespacesPrintable) {
-        switch (i) {
-            case '\n':
-            case '\r':
-            case '\t':
-            case ' ':
-                return true;
-        }
-    }
-    return isprint(i);
-}
-
 uint64_t parsellu(char* string) {
     char* endptr = NULL;
     uint64_t value = strtoull(string, &endptr, 10);
@@ -163,170 +277,1186 @@ uint64_t parsellu(char* string) {
     return value;
 }
 
-bool chunk_accepted(charbuffer_t* buffer, size_t byteOffset) {
-    bool matches = false;
+// The terms of all query sets and the query set of every term.
+dumpfilter_query_t* query = NULL;
+uint32_t* termQuerySet = NULL;
+dumpfilter_options_t scanOptions;
 
-    // Check all search terms if they are contained in the buffer. If
-    // at least one of the terms is included, the chunk will be output.
-    size_t i;
-    for (i=0; i < args.searchTermCount; i++) {
-        if (charbuffer_contains_string(buffer, args.searchTerms[i],
-                NULL, NULL)) {
-            matches = true;
-            break;
+// The chunks that have been written already if -d is used.
+dedup_t* dedup = NULL;
+uint64_t chunkCount = 0;
+uint64_t duplicateCount = 0;
+
+/**
+ * A file to scan. Directories passed on the command-line are replaced
+ * by the files they contain.
+ */
+struct input_file {
+    char* path;
+    uint64_t size;
+
+    // Regular, uncompressed files can be split into ranges that are
+    // scanned in parallel.
+    bool splittable;
+
+    // The read size calibrated for all ranges of a split file, zero if
+    // the ranges choose their own.
+    size_t readSize;
+};
+
+struct input_file* inputFiles = NULL;
+size_t inputFileCount = 0;
+size_t inputFileCapacity = 0;
+
+// With more than one file, the results are written grouped by file and
+// preceded by the path of the file.
+bool groupByFile = false;
+size_t currentFile = 0;
+
+// Progress of all files that are scanned.
+pthread_mutex_t progressLock = PTHREAD_MUTEX_INITIALIZER;
+uint64_t progressBytes = 0;
+uint64_t progressPrint = 0;
+
+void progress(uint64_t bytes) {
+    pthread_mutex_lock(&progressLock);
+    progressBytes += bytes;
+    uint64_t newPrint = progressBytes / 1024 / 1024 / 10;
+    if (newPrint != progressPrint) {
+        fprintf(stderr, "Passed %lluM bytes.\n", (unsigned long long) newPrint * 10);
+        progressPrint = newPrint;
+    }
+    pthread_mutex_unlock(&progressLock);
+}
+
+// The file and position to continue at after --resume. If the results
+// of the file were started before, its index record is not repeated.
+size_t resumeFile = 0;
+uint64_t resumePosition = 0;
+bool resumeStarted = false;
+
+// The checkpoint that is written every -K bytes.
+checkpoint_t checkpoint;
+uint64_t checkpointProgress = 0;
+
+// The free blocks of the file system with -U, which are the only parts
+// of the dump file that are scanned.
+extfs_free_t* freeSpace = NULL;
+
+// Finds file signatures in the same pass with -C and -E, the offsets
+// are written to *carveFile*.
+carve_t* carver = NULL;
+FILE* carveFile = NULL;
+size_t carveHeaderFile = 0;
+
+/**
+ * Returns the position at which scanning the file at *index* starts.
+ */
+uint64_t file_start(size_t index) {
+    if (index == resumeFile && resumePosition > args.nSkipBytes) {
+        return resumePosition;
+    }
+    return args.nSkipBytes;
+}
+
+/**
+ * Start writing the results of the file at *index*.
+ */
+void file_begin(size_t index) {
+    currentFile = index;
+    if (index == resumeFile && resumeStarted) {
+        return;
+    }
+    if (groupByFile && args.indexFile) {
+        struct input_file* file = &inputFiles[index];
+        if (!resindex_write_file(args.indexFile, file->path, file->size)) {
+            fprintf(stderr, "-i: could not write index record.\n");
         }
     }
+}
+
+/**
+ * Write a matching chunk of the current file to the outputs of the
+ * query sets it matched and to the index. Matches must be passed in
+ * the order of the input.
+ */
+bool chunk_emit(const dumpfilter_match_t* match) {
+    size_t i;
+    for (i=0; i < args.querySetCount; i++) {
+        args.querySets[i].matched = false;
+    }
+    for (i=0; i < match->hitCount; i++) {
+        args.querySets[termQuerySet[match->hits[i].term]].matched = true;
+    }
+
+    // Chunks with the same contents match the same query sets, so a
+    // duplicate can be referenced by the offset it was written with.
+    uint64_t hash = 0;
+    uint64_t firstFile = 0;
+    uint64_t firstOffset = 0;
+    bool duplicate = false;
+    if (dedup || args.indexHashes) {
+        hash = hash64(match->data, match->length, 0);
+    }
+    if (dedup) {
+        duplicate = dedup_check(dedup, hash, match->length, currentFile,
+                                match->offset, &firstFile, &firstOffset);
+    }
+    chunkCount++;
+    if (duplicate) {
+        duplicateCount++;
+    }
+
+    for (i=0; i < args.querySetCount && !args.noText; i++) {
+        struct query_set* set = &args.querySets[i];
+        if (!set->matched) {
+            continue;
+        }
+
+        if (groupByFile && set->headerFile != currentFile + 1) {
+            output_printf(set->output, "==> %s <==\n\n",
+                          inputFiles[currentFile].path);
+            set->headerFile = currentFile + 1;
+        }
 
-    if (matches) {
         // Its a printable section and contains the search term.
-        fprintf(args.outFile, "%llu\n", byteOffset);
-        fprintf(args.outFile, ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
+        output_printf(set->output, "%llu\n", (unsigned long long) match->offset);
+        output_printf(set->output, ">>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>\n");
+
+        // The set is shared by all files, the first copy may be in
+        // another one.
+        if (duplicate && firstFile != currentFile) {
+            output_printf(set->output, "==== duplicate of %llu in %s\n\n",
+                          (unsigned long long) firstOffset,
+                          inputFiles[firstFile].path);
+        }
+        else if (duplicate) {
+            output_printf(set->output, "==== duplicate of %llu\n\n",
+                          (unsigned long long) firstOffset);
+        }
+        else {
+            output_write(set->output, match->data, match->length);
+            output_printf(set->output, "\n\n");
+        }
+    }
 
-        charbuffer_to_file(buffer, args.outFile, NULL);
-        fprintf(args.outFile, "\n\n");
+    if (args.indexFile) {
+        resindex_record_t record = {0};
+        record.start = match->start;
+        record.end = match->end;
+        if (args.indexHashes) {
+            record.hash = hash;
+        }
+        if (duplicate) {
+            record.flags |= RESINDEX_DUPLICATE;
+        }
+        record.hitCount = match->hitCount;
+        record.hits = match->hits;
+        if (!resindex_write_record(args.indexFile, &record)) {
+            fprintf(stderr, "-i: could not write index record.\n");
+        }
     }
-    return matches;
+    return true;
 }
 
-int scan_file(FILE* fp) {
-    charbuffer_t* printable = charbuffer_alloc(args.bufSize);
-    if (!printable) {
-        return memory_error();
+bool chunk_matched(void* user, const dumpfilter_match_t* match) {
+    (void) user;
+    return chunk_emit(match);
+}
+
+/**
+ * Write the record of a file signature of the current file.
+ */
+bool carve_matched(void* user, const carve_hit_t* hit) {
+    (void) user;
+    if (!carveFile) {
+        return true;
     }
-    charbuffer_t* unprintable = charbuffer_alloc(args.bufSize);
-    if (!unprintable) {
-        charbuffer_free(printable);
-        return memory_error();
+    if (groupByFile && carveHeaderFile != currentFile + 1) {
+        fprintf(carveFile, "==> %s <==\n", inputFiles[currentFile].path);
+        carveHeaderFile = currentFile + 1;
     }
+    fprintf(carveFile, "%llu %s %llu\n", (unsigned long long) hit->offset,
+            carve_type_name(hit->type), (unsigned long long) hit->size);
+    return !ferror(carveFile);
+}
 
-    size_t chunkSkip = 1024 * 4;
-    uint64_t skipped = 0;
-    while (skipped < args.nSkipBytes) {
-        uint64_t offset;
-        if (skipped + chunkSkip > args.nSkipBytes) {
-            offset = args.nSkipBytes - skipped;
+/**
+ * Returns a hash of everything that changes the results of a scan.
+ */
+uint64_t scan_fingerprint(void) {
+    uint64_t values[] = {
+        args.nUnprintablesAllowed, args.resultMaxSize, args.minChunkSize,
+        args.treatWhitespacesPrintable, args.nSkipBytes, args.nUntil,
+        args.dedupCapacity, args.indexHashes, args.noText, args.outFormat,
+        args.indexFilePath != NULL, args.querySetCount, groupByFile,
+        inputFileCount
+    };
+    uint64_t hash = hash64(values, sizeof(values), dumpfilter_query_hash(query));
+    size_t i;
+    for (i=0; i < args.querySetCount; i++) {
+        uint64_t count = args.querySets[i].termCount;
+        hash = hash64(&count, sizeof(count), hash);
+    }
+    if (args.unallocated) {
+        hash = hash64(&args.fsOffset, sizeof(args.fsOffset), hash);
+    }
+    for (i=0; i < inputFileCount; i++) {
+        hash = hash64(inputFiles[i].path, strlen(inputFiles[i].path), hash);
+        // A followed file grows between the runs.
+        if (!args.follow) {
+            hash = hash64(&inputFiles[i].size, sizeof(uint64_t), hash);
+        }
+    }
+    return hash;
+}
+
+/**
+ * Write a checkpoint if -K bytes were scanned since the last one. The
+ * scan can be continued at *position* of the file at *index* with a
+ * fresh state, and all results before it have been written.
+ */
+void checkpoint_maybe(size_t index, uint64_t position, bool fileStarted) {
+    if (!args.checkpointPath) {
+        return;
+    }
+    pthread_mutex_lock(&progressLock);
+    uint64_t bytes = progressBytes;
+    pthread_mutex_unlock(&progressLock);
+    if (bytes - checkpointProgress < args.checkpointInterval) {
+        return;
+    }
+    checkpointProgress = bytes;
+
+    bool result = true;
+    size_t i;
+    for (i=0; i < args.querySetCount && result; i++) {
+        struct query_set* set = &args.querySets[i];
+        checkpoint.outputSizes[i] = 0;
+        checkpoint.headerFiles[i] = set->headerFile;
+        if (!args.noText) {
+            result = output_sync(set->output, &checkpoint.outputSizes[i]);
+        }
+    }
+    checkpoint.indexSize = 0;
+    if (result && args.indexFile) {
+        off_t size = -1;
+        if (fflush(args.indexFile) == 0 && fsync(fileno(args.indexFile)) == 0) {
+            size = ftello(args.indexFile);
+        }
+        checkpoint.indexSize = size;
+        result = size >= 0;
+    }
+    checkpoint.file = index;
+    checkpoint.position = position;
+    checkpoint.fileStarted = fileStarted;
+    checkpoint.progress = bytes;
+    checkpoint.chunkCount = chunkCount;
+    checkpoint.duplicateCount = duplicateCount;
+    if (!result || !checkpoint_write(args.checkpointPath, &checkpoint, dedup)) {
+        fprintf(stderr, "Could not write checkpoint %s.\n", args.checkpointPath);
+    }
+}
+
+/**
+ * Add a file to the list of files to scan. The path is copied.
+ */
+bool add_file(const char* path, uint64_t size, bool splittable) {
+    if (inputFileCount == inputFileCapacity) {
+        size_t capacity = inputFileCapacity ? inputFileCapacity * 2 : 16;
+        struct input_file* files = reallocate(inputFiles,
+                sizeof(struct input_file) * capacity);
+        if (!files) {
+            return false;
+        }
+        inputFiles = files;
+        inputFileCapacity = capacity;
+    }
+    struct input_file* file = &inputFiles[inputFileCount];
+    file->path = allocate(strlen(path) + 1);
+    if (!file->path) {
+        return false;
+    }
+    strcpy(file->path, path);
+    file->size = size;
+    file->splittable = false;
+    file->readSize = 0;
+    if (splittable && args.compression != DECOMPRESS_NONE) {
+        // Compressed files can only be read from the start.
+        unsigned char magic[4];
+        int fd = open(path, O_RDONLY);
+        ssize_t count = fd >= 0 ? pread(fd, magic, sizeof(magic), 0) : -1;
+        if (fd >= 0) {
+            close(fd);
+        }
+        int format = args.compression;
+        if (format == DECOMPRESS_AUTO && count > 0) {
+            format = decompress_detect(magic, count);
+        }
+        splittable = format == DECOMPRESS_NONE || format == DECOMPRESS_AUTO;
+    }
+    file->splittable = splittable;
+    inputFileCount++;
+    return true;
+}
+
+/**
+ * Add all regular files in the directory at *path* and its
+ * subdirectories, sorted by name. Symbolic links to directories are
+ * not followed.
+ */
+int add_directory(const char* path) {
+    struct dirent** entries = NULL;
+    int count = scandir(path, &entries, NULL, alphasort);
+    if (count < 0) {
+        fprintf(stderr, "Could not read directory %s: %s\n", path, strerror(errno));
+        return 0;
+    }
+
+    int result = 0;
+    int i;
+    for (i=0; i < count; i++) {
+        const char* name = entries[i]->d_name;
+        if (result != 0 || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            free(entries[i]);
+            continue;
+        }
+
+        char* child = allocate(strlen(path) + strlen(name) + 2);
+        if (!child) {
+            result = ENOMEM;
         }
         else {
-            offset = chunkSkip;
+            sprintf(child, "%s/%s", path, name);
+            struct stat st;
+            if (lstat(child, &st) == 0 && S_ISDIR(st.st_mode)) {
+                result = add_directory(child);
+            }
+            else if (stat(child, &st) == 0 && S_ISREG(st.st_mode)) {
+                if (!add_file(child, st.st_size, true)) {
+                    result = ENOMEM;
+                }
+            }
+            deallocate(child);
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return result;
+}
+
+/**
+ * Add the file or directory passed on the command-line.
+ */
+int add_input(const char* path) {
+    struct stat st;
+    if (strcmp(path, "-") == 0 || stat(path, &st) != 0) {
+        // Missing files are reported when they are opened.
+        return add_file(path, 0, false) ? 0 : ENOMEM;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        groupByFile = true;
+        return add_directory(path);
+    }
+    if (S_ISREG(st.st_mode)) {
+        return add_file(path, st.st_size, true) ? 0 : ENOMEM;
+    }
+    return add_file(path, 0, false) ? 0 : ENOMEM;
+}
+
+/**
+ * Tell the user that a compression format was detected in the input,
+ * as the reported offsets then refer to the decompressed data.
+ */
+void note_compression(const input_t* input, const char* path) {
+    if (args.compression == DECOMPRESS_AUTO &&
+            input->compression != DECOMPRESS_NONE) {
+        fprintf(stderr, "%s: %s is %s compressed, offsets refer to the "
+                "decompressed data (-z none scans it as is).\n", args.program,
+                path, decompress_name(input->compression));
+    }
+}
+
+/**
+ * Open a file for scanning and skip to *start*. Returns NULL and
+ * assigns *result* if that fails.
+ */
+input_t* open_file(const struct input_file* file, uint64_t start,
+                   int threads, int* result) {
+    input_t* input = input_open(file->path, args.compression, threads);
+    if (!input) {
+        if (errno == EPROTONOSUPPORT) {
+            fprintf(stderr, "%s: can not decompress input file %s\n", args.program, file->path);
+            *result = EPROTONOSUPPORT;
         }
-        // TODO: Seeking over 2GB fails.
-        int res = fseek(fp, offset, SEEK_CUR);
-        if (res != 0) {
-            fprintf(stderr, "Could not skip %llu bytes, file may be "
-                    "too small. Result: %d\n", args.nSkipBytes, res);
-            charbuffer_free(printable);
-            charbuffer_free(unprintable);
-            return ECANCELED;
+        else {
+            fprintf(stderr, "%s: could not open input file %s\n", args.program, file->path);
+            *result = ENOENT;
         }
-        skipped += offset;
+        return NULL;
+    }
+    if (start == 0) {
+        note_compression(input, file->path);
     }
+    if (!input_skip(input, start)) {
+        fprintf(stderr, "Could not skip %llu bytes, file %s may be "
+                "too small.\n", (unsigned long long) start, file->path);
+        input_close(input);
+        *result = ECANCELED;
+        return NULL;
+    }
+    return input;
+}
 
-    charbuffer_t* printableOpt = printable;
-    charbuffer_t* unprintableOpt = unprintable;
-    uint64_t printableCount = 0;
-    uint64_t unprintableCount = 0;
+/**
+ * Prepare *input* to be read from *start* to *end* (zero for the end of
+ * the input) and return the number of bytes to read at once. This is
+ * -R, *readSize* if it is not zero, or a size chosen for the device.
+ */
+size_t read_size(input_t* input, uint64_t start, uint64_t end, size_t readSize) {
+    static bool directWarned = false;
+    static bool asyncWarned = false;
+    if (args.direct && !input_direct(input)) {
+        pthread_mutex_lock(&progressLock);
+        if (!directWarned) {
+            fprintf(stderr, "Direct I/O is not possible, reading through the page cache.\n");
+            directWarned = true;
+        }
+        pthread_mutex_unlock(&progressLock);
+    }
+    if (args.readSize) {
+        readSize = args.readSize;
+    }
+    // Pipes and decompressors keep the size of their blocks.
+    size_t tuned = input_tune(input, start, end, readSize);
 
-    // For output, the Mb that have previously been printed out.
-    uint64_t prevPrint = 0;
-    uint64_t bytesPassed = skipped;
+    // A followed file grows beyond the range of the reads in flight,
+    // with -U only parts of the range are read.
+    if (args.queueDepth && !args.follow && !freeSpace && input->seekable &&
+            input->compression == DECOMPRESS_NONE &&
+            !input_async(input, end, args.queueDepth)) {
+        pthread_mutex_lock(&progressLock);
+        if (!asyncWarned) {
+            fprintf(stderr, "io_uring is not available (%s), reading synchronously.\n",
+                    strerror(errno));
+            asyncWarned = true;
+        }
+        pthread_mutex_unlock(&progressLock);
+    }
+    return args.readSize ? args.readSize : tuned;
+}
 
-    // The maximum chunk size that was printable, added to the complete
-    // printable buffer.
-    uint64_t maxChunkSize = 0;
-    uint64_t currChunkSize = 0;
+/**
+ * Feed the input to the scanner until it reaches the absolute offset
+ * *end*, or the end of the input if *end* is zero.
+ */
+int scan_range(input_t* input, dumpfilter_t* scanner, char* buffer,
+               size_t readSize, uint64_t end, bool checkpoints) {
+    for (;;) {
+        size_t size = readSize;
+        uint64_t position = dumpfilter_position(scanner);
+        if (end != 0) {
+            if (position >= end) {
+                break;
+            }
+            if (end - position < size) {
+                size = end - position;
+            }
+        }
 
-    uint64_t bytesPrint = 0;
+        ssize_t bytes = input_read(input, buffer, size);
+        if (bytes < 0) {
+            fprintf(stderr, "Could not read input: %s\n", strerror(errno));
+            return EIO;
+        }
+        if (bytes == 0) {
+            break;
+        }
+        if (!dumpfilter_feed(scanner, buffer, bytes)) {
+            return memory_error();
+        }
+        if (carver && !carve_feed(carver, buffer, bytes)) {
+            fprintf(stderr, "Could not write the carving results: %s\n", strerror(errno));
+            return EIO;
+        }
+        progress(bytes);
+        if (checkpoints) {
+            checkpoint_maybe(currentFile, dumpfilter_restart_position(scanner), true);
+        }
+    }
+    return 0;
+}
 
-    // Go through the complete file and search for printable sections.
-    char buffer[args.bufSize];
-    size_t bytes;
-    bool prevPrintable = false;
-    while (printableOpt && unprintableOpt) {
-        bytes = fread(buffer, 1, args.bufSize, fp);
-        if (bytes <= 0) {
+/**
+ * Scan the free blocks of the file system from *start* on. Every
+ * extent of free blocks is scanned like a separate range, chunks do not
+ * continue across the blocks in use between them.
+ */
+int scan_extents(input_t* input, dumpfilter_t* scanner, char* buffer,
+                 size_t readSize, uint64_t start) {
+    bool started = false;
+    size_t i;
+    for (i=0; i < freeSpace->extentCount; i++) {
+        const extfs_extent_t* extent = &freeSpace->extents[i];
+        uint64_t from = extent->start > start ? extent->start : start;
+        uint64_t to = extent->end;
+        if (args.nUntil != 0 && args.nUntil < to) {
+            to = args.nUntil;
+        }
+        if (args.nUntil != 0 && from >= args.nUntil) {
             break;
         }
+        if (from >= to) {
+            continue;
+        }
 
-        int i;
-        for (i=0; i < bytes; i++) {
-            bool isPrintable = is_printable(buffer[i]);
-            if (isPrintable && (args.resultMaxSize == 0 || printableCount <= args.resultMaxSize)) {
-                if (!prevPrintable) {
-                    currChunkSize = 0;
-                }
+        // The image may end before the file system.
+        if (!input_skip(input, from - input->position)) {
+            break;
+        }
+        input_tune(input, from, to, readSize);
+        if (started && !dumpfilter_finish(scanner)) {
+            return memory_error();
+        }
+        if (carver && !carve_seek(carver, from)) {
+            fprintf(stderr, "Could not write the carving results: %s\n", strerror(errno));
+            return EIO;
+        }
+        dumpfilter_reset(scanner, from, NULL);
+        started = true;
 
-                // Append the unprintable characters since they are
-                // allowed due to `args.nUnprintablesAllowed`.
-                printableOpt = charbuffer_append_charbuffer(printable, unprintable, 0);
-                charbuffer_flush(unprintable);
-                unprintableOpt = unprintable;
-                unprintableCount = 0;
+        int result = scan_range(input, scanner, buffer, readSize, to, true);
+        if (result != 0) {
+            return result;
+        }
+        if (input->position < to) {
+            break;
+        }
+    }
+    return 0;
+}
 
-                // Append the current character.
-                printableOpt = charbuffer_append_char(printableOpt, buffer[i]);
-                printableCount++;
+/**
+ * Waits for the dump file to grow with --follow, NULL otherwise.
+ */
+follow_t* follower = NULL;
 
-                currChunkSize++;
-                prevPrintable = true;
-            }
-            else if (unprintableCount > args.nUnprintablesAllowed) {
-                // The number of unprintable character was exceeded.
+/**
+ * Stop following the dump file. A second signal terminates the program.
+ */
+void follow_signal(int sig) {
+    (void) sig;
+    if (follower) {
+        follow_stop(follower);
+    }
+}
 
-                if (currChunkSize > maxChunkSize) {
-                    maxChunkSize = currChunkSize;
-                }
+/**
+ * Pass the results written so far to the files while waiting for more
+ * data, so they can be read in the meantime.
+ */
+bool follow_flush(void) {
+    bool result = true;
+    size_t i;
+    for (i=0; i < args.querySetCount; i++) {
+        if (!output_flush(args.querySets[i].output)) {
+            result = false;
+        }
+    }
+    if (args.indexFile && fflush(args.indexFile) != 0) {
+        result = false;
+    }
+    if (carveFile && fflush(carveFile) != 0) {
+        result = false;
+    }
+    return result;
+}
 
-                bool accepted = args.resultMaxSize == 0;
-                accepted |= printableCount <= args.resultMaxSize;
-                accepted &= maxChunkSize >= args.minChunkSize;
-                if (accepted) {
-                    if (chunk_accepted(printable, bytesPassed + i)) // TODO: Remove this line
-                        fprintf(stderr, ">> Matched with block of %llu max chars.\n", maxChunkSize);
-                }
+/**
+ * Scan a file from *start* on in the calling thread and write the
+ * results immediately. With --follow, the scan continues with the data
+ * appended to the file until it is stopped. The state of the scanner is
+ * kept in the meantime, so a chunk can span the previous end of the
+ * file.
+ */
+int scan_file(size_t index, input_t* input, uint64_t start, dumpfilter_t* scanner) {
+    int result = 0;
+    if (!input) {
+        input = open_file(&inputFiles[index], start, args.threads, &result);
+        if (!input) {
+            return result;
+        }
+    }
+    else if (!input_skip(input, start)) {
+        fprintf(stderr, "Could not skip %llu bytes, file may be "
+                "too small.\n", (unsigned long long) start);
+        input_close(input);
+        return ECANCELED;
+    }
 
-                charbuffer_flush(printable);
-                charbuffer_flush(unprintable);
-                printableCount = 0;
-                unprintableCount = 0;
-                printableOpt = printable;
-                unprintableOpt = unprintable;
-                maxChunkSize = 0;
-                currChunkSize = 0;
+    size_t readSize = read_size(input, start, args.nUntil, 0);
+    char* buffer = allocate_pages(readSize);
+    if (!buffer) {
+        input_close(input);
+        return memory_error();
+    }
+    dumpfilter_reset(scanner, start, NULL);
+    if (carver) {
+        // The files of several dumps are named after the dump as well.
+        char prefix[32] = "";
+        if (groupByFile) {
+            snprintf(prefix, sizeof(prefix), "%lu-", (unsigned long) index);
+        }
+        carve_reset(carver, start, prefix);
+    }
+    if (freeSpace) {
+        result = scan_extents(input, scanner, buffer, readSize, start);
+    }
+    else {
+        result = scan_range(input, scanner, buffer, readSize, args.nUntil, true);
+    }
+    while (result == 0 && follower) {
+        uint64_t position = dumpfilter_position(scanner);
+        if (args.nUntil != 0 && position >= args.nUntil) {
+            break;
+        }
+        if (!follow_flush()) {
+            fprintf(stderr, "Could not write the results.\n");
+            result = EIO;
+            break;
+        }
+        int grown = follow_wait(follower, position);
+        if (grown < 0) {
+            if (errno == ERANGE) {
+                fprintf(stderr, "The input file was truncated.\n");
             }
             else {
-                unprintableOpt = charbuffer_append_char(unprintableOpt, buffer[i]);
-                unprintableCount++;
+                fprintf(stderr, "Could not follow input: %s\n", strerror(errno));
             }
-            prevPrintable = isPrintable;
+            result = EIO;
+        }
+        if (grown <= 0) {
+            break;
+        }
+        result = scan_range(input, scanner, buffer, readSize, args.nUntil, true);
+    }
+    if (result == 0 && !dumpfilter_finish(scanner)) {
+        result = memory_error();
+    }
+    if (result == 0 && carver && !carve_finish(carver)) {
+        fprintf(stderr, "Could not write the carving results: %s\n", strerror(errno));
+        result = EIO;
+    }
+    deallocate_pages(buffer, readSize);
+    input_close(input);
+    return result;
+}
+
+/**
+ * Files larger than twice this size are split into ranges of at least
+ * this size that are scanned in parallel.
+ */
+#define SCAN_SPLIT_SIZE (64 * 1024 * 1024)
+
+/**
+ * The number of bytes that a range is scanned beyond its end to find a
+ * position at which the next range can take over.
+ */
+#define SCAN_SYNC_WINDOW (1024 * 1024)
+
+/**
+ * A range of a file that is scanned by the pool. The matches are
+ * collected in a spool and written by the main thread in order.
+ *
+ * A range after the first one starts with a fresh state, which is only
+ * correct from the first position on where the state would have been
+ * reset anyway. The previous range is therefore scanned for another
+ * `SCAN_SYNC_WINDOW` bytes beyond its end, and both record their reset
+ * positions in that window. From the first common reset position on,
+ * the results of the next range are the same as for a sequential scan.
+ */
+struct scan_task {
+    size_t file;
+    uint64_t start;
+    uint64_t end;
+    uint64_t limit;
+    bool first;
+    bool last;
+
+    uint64_t* headBits;
+    uint64_t* tailBits;
+    spool_t* spool;
+    int result;
+    bool done;
+};
+
+struct scan_worker {
+    dumpfilter_t* scanner;
+    char* buffer;
+    size_t bufferSize;
+};
+
+struct scan_task* scanTasks = NULL;
+size_t scanTaskCount = 0;
+size_t scanTasksSubmitted = 0;
+struct scan_worker* scanWorkers = NULL;
+pool_t* pool = NULL;
+pthread_mutex_t scanLock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t scanDone = PTHREAD_COND_INITIALIZER;
+
+bool task_matched(void* user, const dumpfilter_match_t* match) {
+    struct scan_task* task = user;
+    return spool_add(task->spool, match);
+}
+
+uint64_t* sync_bits_alloc(void) {
+    size_t size = sizeof(uint64_t) * (SCAN_SYNC_WINDOW / 64);
+    uint64_t* bits = allocate(size);
+    if (bits) {
+        memset(bits, 0, size);
+    }
+    return bits;
+}
+
+void task_run(void* arg, int worker) {
+    struct scan_task* task = arg;
+    struct scan_worker* state = &scanWorkers[worker];
+    int result = 0;
+
+    task->spool = spool_alloc();
+    if (!task->first) {
+        task->headBits = sync_bits_alloc();
+    }
+    if (!task->last) {
+        task->tailBits = sync_bits_alloc();
+    }
+    if (!task->spool || (!task->first && !task->headBits) ||
+            (!task->last && !task->tailBits)) {
+        result = memory_error();
+    }
+
+    input_t* input = NULL;
+    if (result == 0) {
+        input = open_file(&inputFiles[task->file], task->start, 1, &result);
+    }
+    if (input) {
+        size_t readSize = read_size(input, task->start,
+                                    task->last ? task->end : task->limit,
+                                    inputFiles[task->file].readSize);
+        if (readSize > state->bufferSize) {
+            readSize = state->bufferSize;
+        }
+        dumpfilter_t* scanner = state->scanner;
+        dumpfilter_reset(scanner, task->start, task);
+        if (!task->first) {
+            dumpfilter_track(scanner, task->headBits, task->start, SCAN_SYNC_WINDOW);
+        }
+        result = scan_range(input, scanner, state->buffer, readSize,
+                            task->end, false);
+        if (result == 0 && task->last && !dumpfilter_finish(scanner)) {
+            result = memory_error();
+        }
+        if (result == 0 && !task->last) {
+            dumpfilter_track(scanner, task->tailBits, task->end,
+                          task->limit - task->end);
+            result = scan_range(input, scanner, state->buffer, readSize,
+                                task->limit, false);
+        }
+        input_close(input);
+    }
+
+    pthread_mutex_lock(&scanLock);
+    task->result = result;
+    task->done = true;
+    pthread_cond_broadcast(&scanDone);
+    pthread_mutex_unlock(&scanLock);
+}
+
+void task_release(struct scan_task* task) {
+    if (task->spool) {
+        spool_free(task->spool);
+        task->spool = NULL;
+    }
+    if (task->headBits) {
+        deallocate(task->headBits);
+        task->headBits = NULL;
+    }
+    if (task->tailBits) {
+        deallocate(task->tailBits);
+        task->tailBits = NULL;
+    }
+}
+
+/**
+ * Wait until the task at *index* is done. Tasks are submitted to the
+ * pool only a few at a time ahead of the task that is written, which
+ * limits the number of spools that exist at once.
+ */
+struct scan_task* task_wait(size_t index) {
+    size_t ahead = pool_workers(pool) * 4;
+    while (scanTasksSubmitted < scanTaskCount &&
+            scanTasksSubmitted <= index + ahead) {
+        struct scan_task* task = &scanTasks[scanTasksSubmitted++];
+        if (!pool_submit(pool, -1, task_run, task)) {
+            task->result = memory_error();
+            task->done = true;
         }
+    }
 
-        bytesPassed += bytes;
+    struct scan_task* task = &scanTasks[index];
+    pthread_mutex_lock(&scanLock);
+    while (!task->done) {
+        pthread_cond_wait(&scanDone, &scanLock);
+    }
+    pthread_mutex_unlock(&scanLock);
+    return task;
+}
 
-        uint64_t newBytesPrint = bytesPassed / 1024 / 1024 / 10;
-        if (newBytesPrint != bytesPrint) {
-            fprintf(stderr, "Passed %lluM bytes.\n", newBytesPrint * 10);
-            bytesPrint = newBytesPrint;
+/**
+ * Find the first position after the end of *task* at which both it
+ * and *next* reset the state.
+ */
+bool task_sync(const struct scan_task* task, const struct scan_task* next,
+               uint64_t* position) {
+    size_t words = (task->limit - task->end + 63) / 64;
+    size_t i;
+    for (i=0; i < words; i++) {
+        uint64_t common = task->tailBits[i] & next->headBits[i];
+        if (common) {
+            *position = task->end + i * 64 + __builtin_ctzll(common);
+            return true;
         }
+    }
+    return false;
+}
 
-        if (args.nUntil != 0 && bytesPassed > args.nUntil) {
-            break;
+/**
+ * Find the last position after the end of the task at which it reset
+ * the state.
+ */
+bool task_last_reset(const struct scan_task* task, uint64_t* position) {
+    size_t i = (task->limit - task->end + 63) / 64;
+    while (i-- > 0) {
+        if (task->tailBits[i]) {
+            *position = task->end + i * 64 + 63 - __builtin_clzll(task->tailBits[i]);
+            return true;
         }
     }
+    return false;
+}
 
-    charbuffer_free(printable);
-    charbuffer_free(unprintable);
+/**
+ * Write the matches of the task with an offset in (*low*, *high*].
+ * The bounds are ignored if *hasLow* or *hasHigh* are false.
+ */
+int task_emit(struct scan_task* task, bool hasLow, uint64_t low,
+              bool hasHigh, uint64_t high) {
+    size_t count = spool_count(task->spool);
+    size_t i;
+    for (i=0; i < count; i++) {
+        uint64_t offset = spool_offset(task->spool, i);
+        if (hasLow && offset <= low) {
+            continue;
+        }
+        if (hasHigh && offset > high) {
+            break;
+        }
+        dumpfilter_match_t match;
+        if (!spool_get(task->spool, i, &match)) {
+            fprintf(stderr, "Could not read back the results of %s.\n",
+                    inputFiles[task->file].path);
+            return EIO;
+        }
+        chunk_emit(&match);
+    }
     return 0;
 }
 
+/**
+ * Write the results of the *count* tasks of a file starting at *first*
+ * in order. If no common reset position is found for two ranges, the
+ * rest of the file is scanned sequentially by *scanner*.
+ */
+int merge_file(size_t first, size_t count, dumpfilter_t* scanner) {
+    size_t index = scanTasks[first].file;
+    file_begin(index);
+
+    int result = 0;
+    bool cut = false;
+    uint64_t low = 0;
+    size_t k;
+    for (k=0; k < count; k++) {
+        struct scan_task* task = task_wait(first + k);
+        if (task->result != 0) {
+            result = task->result;
+            break;
+        }
+        if (task->last) {
+            result = task_emit(task, cut, low, false, 0);
+            task_release(task);
+            break;
+        }
+
+        struct scan_task* next = task_wait(first + k + 1);
+        uint64_t position;
+        if (next->result == 0 && task_sync(task, next, &position)) {
+            result = task_emit(task, cut, low, true, position);
+            task_release(task);
+            cut = true;
+            low = position;
+            if (result != 0) {
+                break;
+            }
+            checkpoint_maybe(index, position + 1, true);
+            continue;
+        }
+        if (next->result != 0) {
+            result = next->result;
+            break;
+        }
+
+        // Continue sequentially after the last position up to which
+        // the results of this task are known to be correct.
+        uint64_t resume = cut ? low + 1 : task->start;
+        if (task_last_reset(task, &position)) {
+            result = task_emit(task, cut, low, true, position);
+            resume = position + 1;
+        }
+        task_release(task);
+        for (k++; k < count; k++) {
+            task_release(task_wait(first + k));
+        }
+        if (result == 0) {
+            result = scan_file(index, NULL, resume, scanner);
+        }
+        return result;
+    }
+
+    // Release the remaining tasks if an error occured.
+    for (k++; k < count; k++) {
+        task_release(task_wait(first + k));
+    }
+    return result;
+}
+
+/**
+ * Returns the number of ranges the file at *index* is split into and
+ * assigns their size to *rangeSize*.
+ */
+size_t file_ranges(size_t index, uint64_t* rangeSize) {
+    struct input_file* file = &inputFiles[index];
+    uint64_t start = file_start(index);
+    uint64_t stop = file->size;
+    if (args.nUntil != 0 && args.nUntil < stop) {
+        stop = args.nUntil;
+    }
+
+    *rangeSize = 0;
+    if (!file->splittable || args.threads < 2 || stop <= start ||
+            stop - start < 2 * (uint64_t) SCAN_SPLIT_SIZE) {
+        return 1;
+    }
+    *rangeSize = (stop - start) / (args.threads * 4);
+    // Checkpoints are only taken between ranges.
+    if (args.checkpointPath && *rangeSize > args.checkpointInterval) {
+        *rangeSize = args.checkpointInterval;
+    }
+    if (*rangeSize < SCAN_SPLIT_SIZE) {
+        *rangeSize = SCAN_SPLIT_SIZE;
+    }
+    return (stop - start) / *rangeSize;
+}
+
+/**
+ * Add the tasks for the file at *index*. Large files are split into
+ * ranges.
+ */
+bool add_tasks(size_t index) {
+    uint64_t start = file_start(index);
+    uint64_t stop = inputFiles[index].size;
+    if (args.nUntil != 0 && args.nUntil < stop) {
+        stop = args.nUntil;
+    }
+    uint64_t rangeSize;
+    size_t ranges = file_ranges(index, &rangeSize);
+
+    // The read size of a split file is calibrated once for all ranges.
+    struct input_file* file = &inputFiles[index];
+    if (ranges > 1 && args.readSize == 0) {
+        input_t* input = input_open(file->path, DECOMPRESS_NONE, 1);
+        if (input) {
+            if (args.direct) {
+                input_direct(input);
+            }
+            file->readSize = input_tune(input, start, stop, 0);
+            input_close(input);
+        }
+    }
+
+    struct scan_task* tasks = reallocate(scanTasks,
+            sizeof(struct scan_task) * (scanTaskCount + ranges));
+    if (!tasks) {
+        return false;
+    }
+    scanTasks = tasks;
+
+    size_t i;
+    for (i=0; i < ranges; i++) {
+        struct scan_task* task = &scanTasks[scanTaskCount++];
+        memset(task, 0, sizeof(struct scan_task));
+        task->file = index;
+        task->first = i == 0;
+        task->last = i == ranges - 1;
+        task->start = start + i * rangeSize;
+        if (task->last) {
+            task->end = args.nUntil;
+        }
+        else {
+            task->end = task->start + rangeSize;
+            task->limit = task->end + SCAN_SYNC_WINDOW;
+            if (task->limit > stop) {
+                task->limit = stop;
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Scan all input files with a pool of -j workers and write the results
+ * grouped by file.
+ */
+int scan_parallel(dumpfilter_t* scanner) {
+    int result = 0;
+    size_t i;
+    for (i=resumeFile; i < inputFileCount; i++) {
+        if (!add_tasks(i)) {
+            return memory_error();
+        }
+    }
+
+    pool = pool_alloc(args.threads);
+    scanWorkers = allocate(sizeof(struct scan_worker) * args.threads);
+    if (!pool || !scanWorkers) {
+        result = memory_error();
+    }
+    else {
+        memset(scanWorkers, 0, sizeof(struct scan_worker) * args.threads);
+    }
+    size_t bufferSize = args.readSize;
+    if (bufferSize < INPUT_MAX_READ_SIZE) {
+        bufferSize = INPUT_MAX_READ_SIZE;
+    }
+    int j;
+    for (j=0; j < args.threads && result == 0; j++) {
+        struct scan_worker* state = &scanWorkers[j];
+        state->scanner = dumpfilter_alloc(query, &scanOptions, task_matched, NULL);
+        state->buffer = allocate_pages(bufferSize);
+        state->bufferSize = bufferSize;
+        if (!state->scanner || !state->buffer) {
+            result = memory_error();
+        }
+    }
+
+    if (args.verbose) {
+        fprintf(stderr, "Scan tasks:             %lu\n", (unsigned long) scanTaskCount);
+    }
+
+    // Write the results file by file, every file has consecutive tasks.
+    // Files that can not be read do not stop the others.
+    int fileError = 0;
+    size_t first = 0;
+    while (result == 0 && first < scanTaskCount) {
+        size_t count = 1;
+        while (first + count < scanTaskCount &&
+                scanTasks[first + count].file == scanTasks[first].file) {
+            count++;
+        }
+        size_t index = scanTasks[first].file;
+        int fileResult = merge_file(first, count, scanner);
+        if (fileResult == ENOMEM || fileResult == EIO) {
+            result = fileResult;
+        }
+        else if (fileResult != 0 && fileError == 0) {
+            fileError = fileResult;
+        }
+        if (result == 0) {
+            checkpoint_maybe(index + 1, args.nSkipBytes, false);
+        }
+        first += count;
+    }
+    if (result == 0) {
+        result = fileError;
+    }
+
+    // Wait for the tasks that are still running after an error.
+    if (pool) {
+        pool_free(pool);
+        pool = NULL;
+    }
+    for (i=0; i < scanTasksSubmitted; i++) {
+        task_release(&scanTasks[i]);
+    }
+    for (j=0; scanWorkers && j < args.threads; j++) {
+        struct scan_worker* state = &scanWorkers[j];
+        if (state->scanner) {
+            dumpfilter_free(state->scanner);
+        }
+        if (state->buffer) {
+            deallocate_pages(state->buffer, state->bufferSize);
+        }
+    }
+    if (scanWorkers) {
+        deallocate(scanWorkers);
+    }
+    if (scanTasks) {
+        deallocate(scanTasks);
+    }
+    return result;
+}
+
 int main(int argc, char** argv) {
     args.argv = argv;
     args.program = argv[0];
     args.bufSize = 1024;
     args.treatWhitespacesPrintable = true;
+    args.compression = DECOMPRESS_AUTO;
+    args.checkpointInterval = 1024L * 1024L * 1024L;
+    args.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (args.threads < 1) {
+        args.threads = 1;
+    }
+
+    // There can not be more query sets than arguments. The first slot
+    // is reserved for the search terms passed on the command-line.
+    args.querySets = allocate(sizeof(struct query_set) * (argc + 1));
+    if (!args.querySets) {
+        return memory_error();
+    }
+    memset(args.querySets, 0, sizeof(struct query_set) * (argc + 1));
+    args.querySetCount = 1;
+    args.termFilePaths = allocate(sizeof(char*) * (argc + 1));
+    if (!args.termFilePaths) {
+        return memory_error();
+    }
+    args.inputPaths = allocate(sizeof(char*) * (argc + 1));
+    if (!args.inputPaths) {
+        return memory_error();
+    }
+    args.inputPathCount = 1;
 
     // Parse the command-line arguments.
     char c;
-    while ((c = getopt(argc, argv, "o:a:b:m:c:s:u:whv")) != -1) {
+    static const struct option longOptions[] = {
+        {"checkpoint", required_argument, NULL, 'k'},
+        {"resume", no_argument, NULL, 'r'},
+        {"follow", no_argument, NULL, 'F'},
+        {"direct", no_argument, NULL, 'D'},
+        {"unallocated", required_argument, NULL, 'U'},
+        {NULL, 0, NULL, 0}
+    };
+    while ((c = getopt_long(argc, argv, "o:a:b:m:c:s:u:i:d:f:I:k:K:q:z:Z:j:R:Q:P:C:E:U:DFHnrwhv",
+                            longOptions, NULL)) != -1) {
         switch (c) {
         case 'o':
             if (args.outFilePath) {
@@ -344,12 +1474,38 @@ int main(int argc, char** argv) {
                 printf("-b: buffer size must be greater than 128 bytes.\n\n");
                 return usage();
             }
+            break;
+        case 'R':
+            args.readSize = parsellu(optarg);
+            if (args.readSize < 1) {
+                printf("-R: must be > 0\n\n");
+                return usage();
+            }
+            break;
+        case 'D':
+            args.direct = true;
+            break;
+        case 'P':
+            args.pages = memory_parse_pages(optarg);
+            if (args.pages < 0) {
+                printf("-P: unknown kind of pages %s.\n\n", optarg);
+                return usage();
+            }
+            break;
+        case 'Q':
+            args.queueDepth = parsellu(optarg);
+            if (args.queueDepth > 4096) {
+                printf("-Q: must be <= 4096\n\n");
+                return usage();
+            }
+            break;
         case 'm':
             args.resultMaxSize = parsellu(optarg);
             if (args.resultMaxSize < 128 && args.resultMaxSize != 0) {
                 printf("-m: must be >= 128 or 0.\n\n");
                 return usage();
             }
+            break;
         case 'c':
             args.minChunkSize = parsellu(optarg);
             if (args.minChunkSize < 0) {
@@ -373,6 +1529,120 @@ int main(int argc, char** argv) {
         case 'u':
             args.nUntil = parsellu(optarg);
             break;
+        case 'i':
+            if (args.indexFilePath) {
+                printf("-i: multiple parameters are not allowed.\n\n");
+                return usage();
+            }
+            args.indexFilePath = optarg;
+            break;
+        case 'H':
+            args.indexHashes = true;
+            break;
+        case 'n':
+            args.noText = true;
+            break;
+        case 'd':
+            args.dedupCapacity = parsellu(optarg);
+            if (args.dedupCapacity < 1) {
+                printf("-d: must be > 0\n\n");
+                return usage();
+            }
+            break;
+        case 'z':
+            args.compression = decompress_parse(optarg);
+            if (args.compression < DECOMPRESS_AUTO) {
+                printf("-z: unknown format %s\n\n", optarg);
+                return usage();
+            }
+            if (!decompress_supported(args.compression)) {
+                printf("-z: %s is not supported by this build\n\n", optarg);
+                return usage();
+            }
+            break;
+        case 'Z': {
+            char* level = strchr(optarg, ':');
+            if (level) {
+                *level++ = 0;
+                args.outLevel = parsellu(level);
+            }
+            args.outFormat = output_parse(optarg);
+            if (args.outFormat < 0) {
+                printf("-Z: unknown format %s\n\n", optarg);
+                return usage();
+            }
+            if (!output_supported(args.outFormat)) {
+                printf("-Z: %s is not supported by this build\n\n", optarg);
+                return usage();
+            }
+            break;
+        }
+        case 'j':
+            args.threads = parsellu(optarg);
+            if (args.threads < 1) {
+                printf("-j: must be > 0\n\n");
+                return usage();
+            }
+            break;
+        case 'f':
+            args.termFilePaths[args.termFileCount++] = optarg;
+            break;
+        case 'I':
+            args.inputPaths[args.inputPathCount++] = optarg;
+            break;
+        case 'k':
+            args.checkpointPath = optarg;
+            break;
+        case 'K':
+            args.checkpointInterval = parsellu(optarg);
+            if (args.checkpointInterval < 1) {
+                printf("-K: must be > 0\n\n");
+                return usage();
+            }
+            break;
+        case 'r':
+            args.resume = true;
+            break;
+        case 'F':
+            args.follow = true;
+            break;
+        case 'C':
+            args.carvePath = optarg;
+            break;
+        case 'U':
+            args.unallocated = true;
+            args.fsOffset = parsellu(optarg);
+            break;
+        case 'E': {
+            char* size = strchr(optarg, ':');
+            if (size) {
+                *size++ = 0;
+                args.extractSize = parsellu(size);
+                if (args.extractSize < 1) {
+                    printf("-E: must be > 0\n\n");
+                    return usage();
+                }
+            }
+            args.extractDir = optarg;
+            break;
+        }
+        case 'q': {
+            struct query_set* set = &args.querySets[args.querySetCount];
+            char* termFile = strchr(optarg, ':');
+            char* outFile = termFile ? strchr(termFile + 1, ':') : NULL;
+            if (!outFile || termFile == optarg || outFile == termFile + 1 ||
+                    !outFile[1]) {
+                printf("-q: expected <name>:<terms-file>:<out-file>.\n\n");
+                return usage();
+            }
+            *termFile++ = 0;
+            *outFile++ = 0;
+            set->name = optarg;
+            set->termFilePath = termFile;
+            set->outFilePath = outFile;
+            args.querySetCount++;
+            break;
+        }
         case '?':
         case 'h':
         default:
@@ -384,62 +1654,486 @@ int main(int argc, char** argv) {
     argc -= optind;
     argv += optind;
 
+    // Before any buffer is allocated.
+    memory_set_pages(args.pages);
+
     if (argc < 1) {
         printf("%s: no input file\n", args.program);
         return EINVAL;
     }
 
     args.inFilePath = argv[0];
+    args.inputPaths[0] = args.inFilePath;
     argc--;
     argv++;
 
-    args.inFile = fopen(args.inFilePath, "rb");
-    if (!args.inFile) {
-        printf("%s: could not open input file %s\n", args.program, args.inFilePath);
-        return ENOENT;
+    size_t i;
+    for (i=0; i < args.inputPathCount; i++) {
+        int result = add_input(args.inputPaths[i]);
+        if (result != 0) {
+            return result == ENOMEM ? memory_error() : result;
+        }
+    }
+    if (args.inputPathCount > 1) {
+        groupByFile = true;
     }
 
-    if (argc < 1) {
-        printf("%s: no search terms\n", args.program);
+    // A single file is opened right away, so errors are reported before
+    // anything is written.
+    if (inputFileCount == 1 && !groupByFile) {
+        args.input = input_open(args.inFilePath, args.compression, args.threads);
+        if (!args.input) {
+            if (errno == EPROTONOSUPPORT) {
+                printf("%s: can not decompress input file %s\n", args.program, args.inFilePath);
+                return EPROTONOSUPPORT;
+            }
+            printf("%s: could not open input file %s\n", args.program, args.inFilePath);
+            return ENOENT;
+        }
+        note_compression(args.input, args.inFilePath);
+    }
+
+    // Only the bytes of a single uncompressed file can be followed.
+    if (args.follow && (!args.input || args.input->pipe ||
+                        args.input->compression != DECOMPRESS_NONE)) {
+        printf("--follow: the dump file must be a single uncompressed file.\n");
         return EINVAL;
     }
 
+    // The block bitmaps are read from the single file system image.
+    if (args.unallocated) {
+        if (!args.input || !args.input->seekable ||
+                args.input->compression != DECOMPRESS_NONE || args.follow) {
+            printf("-U: the dump file must be a single uncompressed file.\n");
+            return EINVAL;
+        }
+        freeSpace = extfs_read_free(args.input->fd, args.fsOffset);
+        if (!freeSpace) {
+            if (errno == EINVAL) {
+                printf("-U: no ext2/3/4 file system at offset %llu.\n",
+                       (unsigned long long) args.fsOffset);
+                return EINVAL;
+            }
+            printf("-U: could not read the block bitmaps: %s\n", strerror(errno));
+            return errno == ENOMEM ? ENOMEM : EIO;
+        }
+    }
+
     args.searchTerms = argv;
     args.searchTermCount = argc;
 
+    if (args.searchTermCount > 0 || args.termFileCount > 0) {
+        struct query_set* set = &args.querySets[0];
+        set->name = "default";
+        set->outFilePath = args.outFilePath;
+    }
+    else {
+        // Without search terms on the command-line or -f, only the sets
+        // passed with -q are used.
+        args.querySetCount--;
+        memmove(args.querySets, args.querySets + 1,
+                sizeof(struct query_set) * args.querySetCount);
+    }
+
+    if (args.querySetCount < 1) {
+        printf("%s: no search terms\n", args.program);
+        return EINVAL;
+    }
+
+    // Compile the terms of all query sets into one query, so every
+    // chunk has to be searched only once.
+    query = dumpfilter_query_alloc();
+    if (!query) {
+        return memory_error();
+    }
+    for (i=0; i < args.querySetCount; i++) {
+        struct query_set* set = &args.querySets[i];
+        set->firstTerm = dumpfilter_query_count(query);
+        if (set->termFilePath) {
+            size_t count;
+            if (!dumpfilter_query_add_file(query, set->termFilePath, &count)) {
+                printf("-q: could not read terms file %s\n", set->termFilePath);
+                return ENOENT;
+            }
+        }
+        else {
+            size_t j;
+            for (j=0; j < args.searchTermCount; j++) {
+                const char* term = args.searchTerms[j];
+                if (!dumpfilter_query_add(query, term, strlen(term))) {
+                    return memory_error();
+                }
+            }
+            for (j=0; j < args.termFileCount; j++) {
+                if (!dumpfilter_query_add_file(query, args.termFilePaths[j], NULL)) {
+                    printf("-f: could not read terms file %s\n", args.termFilePaths[j]);
+                    return ENOENT;
+                }
+            }
+        }
+        set->termCount = dumpfilter_query_count(query) - set->firstTerm;
+    }
+
+    if (!dumpfilter_query_compile(query)) {
+        return memory_error();
+    }
+    termQuerySet = allocate(sizeof(uint32_t) * (dumpfilter_query_count(query) + 1));
+    if (!termQuerySet) {
+        return memory_error();
+    }
+    for (i=0; i < args.querySetCount; i++) {
+        struct query_set* set = &args.querySets[i];
+        uint32_t j;
+        for (j=0; j < set->termCount; j++) {
+            termQuerySet[set->firstTerm + j] = i;
+        }
+    }
+
     if (args.verbose) {
-        fprintf(stderr, "Input File:             %s\n", args.inFilePath);
+        if (args.input) {
+            fprintf(stderr, "Input File:             %s\n", args.inFilePath);
+            fprintf(stderr, "Input type:             %s\n", (args.input->pipe ? "pipe" : "file"));
+            fprintf(stderr, "Compression:            %s\n", decompress_name(args.input->compression));
+        }
+        else {
+            fprintf(stderr, "Input files:            %lu\n", (unsigned long) inputFileCount);
+            for (i=0; i < inputFileCount; i++) {
+                fprintf(stderr, " |  %s\n", inputFiles[i].path);
+            }
+        }
+        fprintf(stderr, "Threads:                %d\n", args.threads);
         fprintf(stderr, "Output file:            %s\n", (args.outFilePath ? args.outFilePath : "stdout"));
+        fprintf(stderr, "Output compression:     %s\n", (args.outFormat == OUTPUT_GZIP ? "gzip" : args.outFormat == OUTPUT_ZSTD ? "zstd" : "none"));
         fprintf(stderr, "unprintables allowed:   %llu\n", args.nUnprintablesAllowed);
         fprintf(stderr, "Buffer size:            %llu\n", args.bufSize);
+        if (args.readSize) {
+            fprintf(stderr, "Read size:              %llu\n", (unsigned long long) args.readSize);
+        }
+        else {
+            fprintf(stderr, "Read size:              auto\n");
+        }
+        fprintf(stderr, "Direct I/O:             %s\n", (args.direct ? "Yes" : "No"));
+        fprintf(stderr, "Queue depth:            %u\n", args.queueDepth);
         fprintf(stderr, "Bytes to skip:          %llu\n", args.nSkipBytes);
         fprintf(stderr, "Max chunk-size:         %llu\n", args.resultMaxSize);
         fprintf(stderr, "Min Sub-chunk size:     %llu\n", args.minChunkSize);
         fprintf(stderr, "Wspace as printables:   %s\n", (args.treatWhitespacesPrintable ? "Yes" : "No"));
-        fprintf(stderr, "Search Terms:\n");
-        int i;
-        for (i=0; i < args.searchTermCount; i++) {
-            fprintf(stderr, " |  %s\n", args.searchTerms[i]);
+        fprintf(stderr, "Index file:             %s\n", (args.indexFilePath ? args.indexFilePath : "none"));
+        fprintf(stderr, "Index hashes:           %s\n", (args.indexHashes ? "Yes" : "No"));
+        fprintf(stderr, "Deduplication:          %llu\n",
+                (unsigned long long) args.dedupCapacity);
+        if (freeSpace) {
+            fprintf(stderr, "Free blocks:            %llu of %llu (%llu bytes each)\n",
+                    (unsigned long long) freeSpace->freeBlocks,
+                    (unsigned long long) freeSpace->blockCount,
+                    (unsigned long long) freeSpace->blockSize);
+            fprintf(stderr, "Free extents:           %lu\n",
+                    (unsigned long) freeSpace->extentCount);
+        }
+        fprintf(stderr, "Carving results:        %s\n", (args.carvePath ? args.carvePath : "none"));
+        if (args.extractDir) {
+            fprintf(stderr, "Extract to:             %s (%llu bytes)\n", args.extractDir,
+                    (unsigned long long) (args.extractSize ? args.extractSize : CARVE_EXTRACT_SIZE));
+        }
+        if (args.searchTermCount > 0) {
+            fprintf(stderr, "Search Terms:\n");
+            for (i=0; i < args.searchTermCount; i++) {
+                fprintf(stderr, " |  %s\n", args.searchTerms[i]);
+            }
+        }
+        if (args.termFileCount > 0) {
+            fprintf(stderr, "Terms files:\n");
+            for (i=0; i < args.termFileCount; i++) {
+                fprintf(stderr, " |  %s\n", args.termFilePaths[i]);
+            }
+            fprintf(stderr, "Total terms:            %lu\n",
+                    (unsigned long) dumpfilter_query_count(query));
+        }
+        for (i=0; i < args.querySetCount; i++) {
+            struct query_set* set = &args.querySets[i];
+            if (set->termFilePath) {
+                fprintf(stderr, "Query set %s:\n", set->name);
+                fprintf(stderr, " |  Terms file:         %s (%lu terms)\n",
+                        set->termFilePath, (unsigned long) set->termCount);
+                fprintf(stderr, " |  Output file:        %s\n", set->outFilePath);
+            }
         }
         fprintf(stderr, "\n");
     }
 
-    // Open the output file.
-    if (args.outFilePath) {
-        args.outFile = fopen(args.outFilePath, "wb");
-        if (!args.outFile) {
-            printf("-o: File %s could not be opened.\n", optarg);
+    if (args.dedupCapacity) {
+        dedup = dedup_alloc(args.dedupCapacity);
+        if (!dedup) {
+            return memory_error();
+        }
+    }
+
+    // Checkpoints record the sizes of the outputs, which requires files.
+    if (args.resume && !args.checkpointPath) {
+        printf("--resume: no checkpoint file (-k) given.\n\n");
+        return usage();
+    }
+    for (i=0; i < args.querySetCount && args.checkpointPath && !args.noText; i++) {
+        const char* path = args.querySets[i].outFilePath;
+        if (!path || strcmp(path, "-") == 0) {
+            printf("-k: checkpoints can not be used with the standard output.\n");
+            return EINVAL;
+        }
+    }
+    if (args.checkpointPath && (args.carvePath || args.extractDir)) {
+        printf("-k: checkpoints can not be used with -C and -E.\n");
+        return EINVAL;
+    }
+    if (args.checkpointPath && args.threads > 1 &&
+            args.checkpointInterval < SCAN_SPLIT_SIZE) {
+        fprintf(stderr, "-K: with -j, checkpoints are at least %dM apart.\n",
+                SCAN_SPLIT_SIZE / (1024 * 1024));
+    }
+    if (args.checkpointPath) {
+        checkpoint.fingerprint = scan_fingerprint();
+        checkpoint.outputCount = args.querySetCount;
+        checkpoint.outputSizes = allocate(sizeof(uint64_t) * args.querySetCount);
+        checkpoint.headerFiles = allocate(sizeof(uint64_t) * args.querySetCount);
+        if (!checkpoint.outputSizes || !checkpoint.headerFiles) {
+            return memory_error();
+        }
+    }
+
+    // Continue from the checkpoint. Without one, the scan starts from
+    // the beginning, so the same command can simply be repeated.
+    if (args.resume) {
+        uint64_t fingerprint = checkpoint.fingerprint;
+        if (!checkpoint_read(args.checkpointPath, &checkpoint, dedup)) {
+            if (errno != ENOENT) {
+                printf("--resume: %s is not a valid checkpoint.\n", args.checkpointPath);
+                return EINVAL;
+            }
+            fprintf(stderr, "No checkpoint %s, starting from the beginning.\n",
+                    args.checkpointPath);
+            args.resume = false;
+        }
+        else if (checkpoint.fingerprint != fingerprint) {
+            printf("--resume: %s was written for other options or input files.\n",
+                   args.checkpointPath);
+            return EINVAL;
+        }
+        else {
+            resumeFile = checkpoint.file;
+            resumePosition = checkpoint.position;
+            resumeStarted = checkpoint.fileStarted;
+            chunkCount = checkpoint.chunkCount;
+            duplicateCount = checkpoint.duplicateCount;
+            progressBytes = checkpoint.progress;
+            progressPrint = progressBytes / 1024 / 1024 / 10;
+            checkpointProgress = progressBytes;
+            for (i=0; i < args.querySetCount; i++) {
+                args.querySets[i].headerFile = checkpoint.headerFiles[i];
+            }
+            if (args.verbose) {
+                fprintf(stderr, "Resuming at:            %llu (file %llu)\n",
+                        (unsigned long long) resumePosition,
+                        (unsigned long long) resumeFile);
+            }
+        }
+    }
+
+    // Open the output files.
+    for (i=0; i < args.querySetCount; i++) {
+        struct query_set* set = &args.querySets[i];
+        if (args.resume && !args.noText) {
+            set->output = output_resume(set->outFilePath, args.outFormat,
+                                        args.outLevel, args.threads,
+                                        checkpoint.outputSizes[i]);
+        }
+        else {
+            set->output = output_open(set->outFilePath, args.outFormat,
+                                      args.outLevel, args.threads);
+        }
+        if (!set->output) {
+            printf("%s: File %s could not be opened.\n",
+                   (set->termFilePath ? "-q" : "-o"),
+                   (set->outFilePath ? set->outFilePath : "stdout"));
+            return ENOENT;
+        }
+    }
+
+    // Open the index file.
+    if (args.indexFilePath && args.resume) {
+        args.indexFile = fopen(args.indexFilePath, "r+b");
+        uint32_t version, flags;
+        if (args.indexFile && !resindex_read_header(args.indexFile, &version, &flags)) {
+            printf("-i: %s is not an index of a known version.\n", args.indexFilePath);
+            return EINVAL;
+        }
+        if (!args.indexFile ||
+                ftruncate(fileno(args.indexFile), checkpoint.indexSize) != 0 ||
+                fseeko(args.indexFile, 0, SEEK_END) != 0) {
+            printf("-i: File %s could not be continued.\n", args.indexFilePath);
+            return ENOENT;
+        }
+    }
+    else if (args.indexFilePath) {
+        args.indexFile = fopen(args.indexFilePath, "wb");
+        if (!args.indexFile) {
+            printf("-i: File %s could not be opened.\n", args.indexFilePath);
+            return ENOENT;
+        }
+        uint32_t flags = args.indexHashes ? RESINDEX_HAS_HASH : 0;
+        if (groupByFile) {
+            flags |= RESINDEX_HAS_FILES;
+        }
+        // Readers of version 1 do not know file records and flags.
+        uint32_t version = groupByFile || dedup ? RESINDEX_VERSION : 1;
+        if (!resindex_write_header(args.indexFile, version, flags)) {
+            printf("-i: could not write index header.\n");
+            return EIO;
+        }
+    }
+
+    // Open the carving results and the directory of extracted files.
+    if (args.carvePath && strcmp(args.carvePath, "-") == 0) {
+        carveFile = stdout;
+    }
+    else if (args.carvePath) {
+        carveFile = fopen(args.carvePath, "w");
+        if (!carveFile) {
+            printf("-C: File %s could not be opened.\n", args.carvePath);
             return ENOENT;
         }
     }
+    if (args.extractDir && mkdir(args.extractDir, 0777) != 0 && errno != EEXIST) {
+        printf("-E: Directory %s could not be created.\n", args.extractDir);
+        return ENOENT;
+    }
+    if (args.carvePath || args.extractDir) {
+        carver = carve_alloc(args.extractDir, args.extractSize, carve_matched, NULL);
+        if (!carver) {
+            return memory_error();
+        }
+    }
+
+    // With a single set and no index, the first hit of a chunk is
+    // enough.
+    memset(&scanOptions, 0, sizeof(scanOptions));
+    scanOptions.unprintablesAllowed = args.nUnprintablesAllowed;
+    scanOptions.resultMaxSize = args.resultMaxSize;
+    scanOptions.minChunkSize = args.minChunkSize;
+    scanOptions.whitespacePrintable = args.treatWhitespacesPrintable;
+    scanOptions.firstOnly = args.querySetCount == 1 && !args.indexFile;
+    scanOptions.bufSize = args.bufSize;
+    dumpfilter_t* scanner = dumpfilter_alloc(query, &scanOptions, chunk_matched, NULL);
+    if (!scanner) {
+        return memory_error();
+    }
+
+    // Several files or a large one are scanned by a pool of threads,
+    // everything else in this thread.
+    int result = 0;
+    uint64_t rangeSize;
+    if (args.follow && resumeFile == 0) {
+        const char* path = strcmp(args.inFilePath, "-") == 0 ? NULL : args.inFilePath;
+        follower = follow_alloc(args.input->fd, path, FOLLOW_INTERVAL);
+        if (!follower) {
+            return memory_error();
+        }
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = follow_signal;
+        action.sa_flags = SA_RESETHAND;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+    }
+    // The signatures are searched in the order of the input, so carving
+    // scans the files in this thread as well, like the free blocks.
+    if (args.threads > 1 && !args.follow && !carver && !freeSpace && inputFileCount > 0 &&
+            (inputFileCount > 1 || file_ranges(0, &rangeSize) > 1)) {
+        if (args.input) {
+            input_close(args.input);
+            args.input = NULL;
+        }
+        result = scan_parallel(scanner);
+    }
     else {
-        args.outFile = stdout;
+        if (resumeFile > 0 && args.input) {
+            input_close(args.input);
+            args.input = NULL;
+        }
+        for (i=resumeFile; i < inputFileCount; i++) {
+            file_begin(i);
+            int fileResult = scan_file(i, args.input, file_start(i), scanner);
+            args.input = NULL;
+            if (fileResult == ENOMEM || fileResult == EIO) {
+                result = fileResult;
+                break;
+            }
+            if (fileResult != 0 && result == 0) {
+                result = fileResult;
+            }
+            checkpoint_maybe(i + 1, args.nSkipBytes, false);
+        }
+    }
+    if (follower) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        follow_t* follow = follower;
+        follower = NULL;
+        follow_free(follow);
+    }
+    dumpfilter_free(scanner);
+    carve_free(carver);
+    extfs_free(freeSpace);
+    if (carveFile && carveFile != stdout && fclose(carveFile) != 0) {
+        fprintf(stderr, "Could not write %s.\n", args.carvePath);
+        if (result == 0) {
+            result = EIO;
+        }
+    }
+    if (args.verbose && dedup) {
+        fprintf(stderr, "Duplicate chunks:       %llu of %llu\n",
+                (unsigned long long) duplicateCount,
+                (unsigned long long) chunkCount);
+    }
+    dedup_free(dedup);
+    deallocate(termQuerySet);
+    dumpfilter_query_free(query);
+    if (args.indexFile) {
+        fclose(args.indexFile);
+    }
+    for (i=0; i < args.querySetCount; i++) {
+        struct query_set* set = &args.querySets[i];
+        if (!output_close(set->output)) {
+            fprintf(stderr, "Could not write %s.\n",
+                    (set->outFilePath ? set->outFilePath : "stdout"));
+            if (result == 0) {
+                result = EIO;
+            }
+        }
+    }
+    for (i=0; i < inputFileCount; i++) {
+        deallocate(inputFiles[i].path);
+    }
+    if (inputFiles) {
+        deallocate(inputFiles);
     }
 
-    int result = scan_file(args.inFile);
+    // A complete scan needs no checkpoint anymore.
+    if (args.checkpointPath && result == 0) {
+        unlink(args.checkpointPath);
+    }
+    if (checkpoint.outputSizes) {
+        deallocate(checkpoint.outputSizes);
+    }
+    if (checkpoint.headerFiles) {
+        deallocate(checkpoint.headerFiles);
+    }
+    deallocate(args.querySets);
+    deallocate(args.termFilePaths);
+    deallocate(args.inputPaths);
     memory_info(stderr);
 
     if (args.verbose) {
+        memory_page_info(stderr);
         printf("scan_file() result: %d\n", result);
     }
     return result;
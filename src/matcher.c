@@ -0,0 +1,497 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#define _GNU_SOURCE
+
+#include "matcher.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct matcher {
+    // All terms are stored back to back in the pool, *offsets* and
+    // *lengths* describe where a term is located.
+    char* pool;
+    size_t poolSize;
+    size_t poolCapacity;
+    uint64_t* offsets;
+    uint32_t* lengths;
+    size_t count;
+    size_t capacity;
+    bool compiled;
+
+    // Terms with at least MATCHER_GRAM bytes, grouped by the hash of
+    // their first gram. A bucket lists the distinct pairs of gram and
+    // term length from `bucketStart[i]` to `bucketStart[i + 1]` in
+    // *bucketKeys* and *bucketLengths*, sorted by gram and length. The
+    // bit of every non-empty bucket is set in *filter*, which is small
+    // enough to stay in the cache.
+    unsigned int bucketBits;
+    uint64_t* filter;
+    uint32_t* bucketStart;
+    uint32_t* bucketKeys;
+    uint32_t* bucketLengths;
+
+    // The same terms in an open addressing table by the hash of the
+    // whole term, which is probed once for every length of a bucket.
+    // Empty slots are UINT32_MAX.
+    unsigned int tableBits;
+    uint32_t* tableTerms;
+    uint64_t* tableHashes;
+
+    // Terms shorter than MATCHER_GRAM, grouped by their first byte.
+    uint32_t shortStart[257];
+    uint32_t* shortTerms;
+
+    // Empty terms, they are contained in every block.
+    uint32_t* emptyTerms;
+    size_t emptyCount;
+};
+
+static inline uint32_t matcher_key(const char* p) {
+    uint32_t key;
+    memcpy(&key, p, sizeof(key));
+    return key;
+}
+
+static inline uint32_t matcher_bucket(const matcher_t* matcher, uint32_t key) {
+    return (key * 2654435761u) >> (32 - matcher->bucketBits);
+}
+
+/**
+ * Continue the FNV-1a hash *hash* of a term with *length* more bytes.
+ */
+static inline uint64_t matcher_hash(uint64_t hash, const char* p, size_t length) {
+    size_t i;
+    for (i=0; i < length; i++) {
+        hash ^= (unsigned char) p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+#define MATCHER_HASH_INIT 14695981039346656037ull
+
+/**
+ * A term with at least MATCHER_GRAM bytes while the buckets are built.
+ */
+struct matcher_pair {
+    uint32_t bucket;
+    uint32_t key;
+    uint32_t length;
+};
+
+static int matcher_pair_compare(const void* a, const void* b) {
+    const struct matcher_pair* x = a;
+    const struct matcher_pair* y = b;
+    if (x->bucket != y->bucket) {
+        return x->bucket < y->bucket ? -1 : 1;
+    }
+    if (x->key != y->key) {
+        return x->key < y->key ? -1 : 1;
+    }
+    if (x->length != y->length) {
+        return x->length < y->length ? -1 : 1;
+    }
+    return 0;
+}
+
+matcher_t* matcher_alloc(void) {
+    matcher_t* matcher = allocate(sizeof(matcher_t));
+    if (matcher) {
+        memset(matcher, 0, sizeof(matcher_t));
+    }
+    return matcher;
+}
+
+static void matcher_release(void* ptr) {
+    if (ptr) {
+        deallocate(ptr);
+    }
+}
+
+void matcher_free(matcher_t* matcher) {
+    if (!matcher) {
+        return;
+    }
+    matcher_release(matcher->pool);
+    matcher_release(matcher->offsets);
+    matcher_release(matcher->lengths);
+    matcher_release(matcher->filter);
+    matcher_release(matcher->bucketStart);
+    matcher_release(matcher->bucketKeys);
+    matcher_release(matcher->bucketLengths);
+    matcher_release(matcher->tableTerms);
+    matcher_release(matcher->tableHashes);
+    matcher_release(matcher->shortTerms);
+    matcher_release(matcher->emptyTerms);
+    deallocate(matcher);
+}
+
+bool matcher_add(matcher_t* matcher, const char* term, size_t length) {
+    if (!matcher || matcher->compiled || length > UINT32_MAX) {
+        return false;
+    }
+
+    if (matcher->count >= matcher->capacity) {
+        size_t capacity = matcher->capacity ? matcher->capacity * 2 : 64;
+        uint64_t* offsets = reallocate(
+                matcher->offsets, sizeof(uint64_t) * capacity);
+        if (!offsets) {
+            return false;
+        }
+        matcher->offsets = offsets;
+        uint32_t* lengths = reallocate(
+                matcher->lengths, sizeof(uint32_t) * capacity);
+        if (!lengths) {
+            return false;
+        }
+        matcher->lengths = lengths;
+        matcher->capacity = capacity;
+    }
+
+    if (matcher->poolSize + length > matcher->poolCapacity) {
+        size_t capacity = matcher->poolCapacity ? matcher->poolCapacity : 4096;
+        while (capacity < matcher->poolSize + length) {
+            capacity *= 2;
+        }
+        char* pool = reallocate(matcher->pool, capacity);
+        if (!pool) {
+            return false;
+        }
+        matcher->pool = pool;
+        matcher->poolCapacity = capacity;
+    }
+
+    memcpy(matcher->pool + matcher->poolSize, term, length);
+    matcher->offsets[matcher->count] = matcher->poolSize;
+    matcher->lengths[matcher->count] = (uint32_t) length;
+    matcher->poolSize += length;
+    matcher->count++;
+    return true;
+}
+
+bool matcher_add_file(
+        matcher_t* matcher, const char* filename, size_t* outCount) {
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        return false;
+    }
+
+    bool result = true;
+    size_t count = 0;
+    char* line = NULL;
+    size_t lineSize = 0;
+    ssize_t length;
+    while ((length = getline(&line, &lineSize, fp)) != -1) {
+        while (length > 0 && (line[length - 1] == '\n' ||
+                              line[length - 1] == '\r')) {
+            length--;
+        }
+        if (length == 0) {
+            continue;
+        }
+        if (!matcher_add(matcher, line, length)) {
+            result = false;
+            break;
+        }
+        count++;
+    }
+    if (ferror(fp)) {
+        result = false;
+    }
+
+    free(line);
+    fclose(fp);
+    if (outCount) {
+        *outCount = count;
+    }
+    return result;
+}
+
+size_t matcher_count(const matcher_t* matcher) {
+    return matcher->count;
+}
+
+const char* matcher_term(
+        const matcher_t* matcher, uint32_t term, size_t* outLength) {
+    if (outLength) {
+        *outLength = matcher->lengths[term];
+    }
+    return matcher->pool + matcher->offsets[term];
+}
+
+bool matcher_compile(matcher_t* matcher) {
+    if (matcher->compiled) {
+        return true;
+    }
+
+    size_t longCount = 0;
+    size_t shortCount = 0;
+    uint32_t i;
+    for (i=0; i < matcher->count; i++) {
+        if (matcher->lengths[i] >= MATCHER_GRAM) {
+            longCount++;
+        }
+        else if (matcher->lengths[i] > 0) {
+            shortCount++;
+        }
+    }
+
+    // Use about two buckets per term to keep the buckets short, and
+    // a table that is at most half full.
+    matcher->bucketBits = 6;
+    while (((size_t) 1 << matcher->bucketBits) < longCount * 2 &&
+            matcher->bucketBits < 31) {
+        matcher->bucketBits++;
+    }
+    size_t bucketCount = (size_t) 1 << matcher->bucketBits;
+    matcher->tableBits = matcher->bucketBits;
+    size_t tableSize = bucketCount;
+
+    struct matcher_pair* pairs = allocate(sizeof(struct matcher_pair) * (longCount + 1));
+    matcher->filter = allocate(bucketCount / 8);
+    matcher->bucketStart = allocate(sizeof(uint32_t) * (bucketCount + 1));
+    matcher->bucketKeys = allocate(sizeof(uint32_t) * (longCount + 1));
+    matcher->bucketLengths = allocate(sizeof(uint32_t) * (longCount + 1));
+    matcher->tableTerms = allocate(sizeof(uint32_t) * tableSize);
+    matcher->tableHashes = allocate(sizeof(uint64_t) * tableSize);
+    matcher->shortTerms = allocate(sizeof(uint32_t) * (shortCount + 1));
+    matcher->emptyTerms = allocate(sizeof(uint32_t) *
+            (matcher->count - longCount - shortCount + 1));
+    if (!pairs || !matcher->filter || !matcher->bucketStart ||
+            !matcher->bucketKeys || !matcher->bucketLengths ||
+            !matcher->tableTerms || !matcher->tableHashes ||
+            !matcher->shortTerms || !matcher->emptyTerms) {
+        matcher_release(pairs);
+        return false;
+    }
+    memset(matcher->filter, 0, bucketCount / 8);
+    memset(matcher->bucketStart, 0, sizeof(uint32_t) * (bucketCount + 1));
+    memset(matcher->tableTerms, 0xFF, sizeof(uint32_t) * tableSize);
+    memset(matcher->shortStart, 0, sizeof(matcher->shortStart));
+
+    // Insert the long terms into the table and collect the pairs of
+    // gram and length of every bucket. Count the short terms per first
+    // byte and turn the counts into start indices.
+    size_t pairCount = 0;
+    size_t mask = tableSize - 1;
+    for (i=0; i < matcher->count; i++) {
+        const char* term = matcher->pool + matcher->offsets[i];
+        uint32_t length = matcher->lengths[i];
+        if (length >= MATCHER_GRAM) {
+            uint64_t hash = matcher_hash(MATCHER_HASH_INIT, term, length);
+            size_t slot = hash & mask;
+            while (matcher->tableTerms[slot] != UINT32_MAX) {
+                slot = (slot + 1) & mask;
+            }
+            matcher->tableTerms[slot] = i;
+            matcher->tableHashes[slot] = hash;
+
+            uint32_t key = matcher_key(term);
+            pairs[pairCount].bucket = matcher_bucket(matcher, key);
+            pairs[pairCount].key = key;
+            pairs[pairCount].length = length;
+            pairCount++;
+        }
+        else if (length > 0) {
+            matcher->shortStart[(unsigned char) term[0] + 1]++;
+        }
+    }
+    size_t j;
+    for (j=0; j < 256; j++) {
+        matcher->shortStart[j + 1] += matcher->shortStart[j];
+    }
+
+    // Terms with the same gram and length only need to be probed once.
+    qsort(pairs, pairCount, sizeof(struct matcher_pair), matcher_pair_compare);
+    size_t distinct = 0;
+    for (j=0; j < pairCount; j++) {
+        if (distinct > 0 && matcher_pair_compare(&pairs[j], &pairs[distinct - 1]) == 0) {
+            continue;
+        }
+        pairs[distinct] = pairs[j];
+        matcher->bucketKeys[distinct] = pairs[j].key;
+        matcher->bucketLengths[distinct] = pairs[j].length;
+        matcher->bucketStart[pairs[j].bucket + 1]++;
+        matcher->filter[pairs[j].bucket / 64] |= (uint64_t) 1 << (pairs[j].bucket % 64);
+        distinct++;
+    }
+    matcher_release(pairs);
+    for (j=0; j < bucketCount; j++) {
+        matcher->bucketStart[j + 1] += matcher->bucketStart[j];
+    }
+
+    // Distribute the short terms, this shifts the start indices by one
+    // byte which is undone afterwards.
+    matcher->emptyCount = 0;
+    for (i=0; i < matcher->count; i++) {
+        const char* term = matcher->pool + matcher->offsets[i];
+        if (matcher->lengths[i] >= MATCHER_GRAM) {
+            continue;
+        }
+        if (matcher->lengths[i] > 0) {
+            uint32_t index = matcher->shortStart[(unsigned char) term[0]]++;
+            matcher->shortTerms[index] = i;
+        }
+        else {
+            matcher->emptyTerms[matcher->emptyCount++] = i;
+        }
+    }
+    for (j=256; j > 0; j--) {
+        matcher->shortStart[j] = matcher->shortStart[j - 1];
+    }
+    matcher->shortStart[0] = 0;
+
+    matcher->compiled = true;
+    return true;
+}
+
+matcher_result_t* matcher_result_alloc(const matcher_t* matcher) {
+    matcher_result_t* result = allocate(sizeof(matcher_result_t));
+    if (!result) {
+        return NULL;
+    }
+    result->count = 0;
+    result->capacity = 64;
+    result->generation = 0;
+    result->hits = allocate(sizeof(matcher_hit_t) * result->capacity);
+    result->stamps = allocate(sizeof(uint32_t) * (matcher->count + 1));
+    if (!result->hits || !result->stamps) {
+        matcher_result_free(result);
+        return NULL;
+    }
+    memset(result->stamps, 0, sizeof(uint32_t) * (matcher->count + 1));
+    return result;
+}
+
+void matcher_result_free(matcher_result_t* result) {
+    if (result) {
+        matcher_release(result->hits);
+        matcher_release(result->stamps);
+        deallocate(result);
+    }
+}
+
+/**
+ * Add a hit to the result unless the term was already found in the
+ * current scan. Returns false on a memory error.
+ */
+static bool matcher_report(matcher_result_t* result, uint32_t term,
+                           uint64_t offset) {
+    if (result->stamps[term] == result->generation) {
+        return true;
+    }
+    if (result->count >= result->capacity) {
+        size_t capacity = result->capacity * 2;
+        matcher_hit_t* hits = reallocate(
+                result->hits, sizeof(matcher_hit_t) * capacity);
+        if (!hits) {
+            return false;
+        }
+        result->hits = hits;
+        result->capacity = capacity;
+    }
+    result->stamps[term] = result->generation;
+    result->hits[result->count].term = term;
+    result->hits[result->count].offset = offset;
+    result->count++;
+    return true;
+}
+
+size_t matcher_scan(
+        const matcher_t* matcher, matcher_result_t* result,
+        const char* data, size_t size, bool firstOnly) {
+    result->count = 0;
+    result->generation++;
+    if (result->generation == 0) {
+        memset(result->stamps, 0, sizeof(uint32_t) * (matcher->count + 1));
+        result->generation = 1;
+    }
+
+    size_t i;
+    for (i=0; i < matcher->emptyCount; i++) {
+        matcher_report(result, matcher->emptyTerms[i], 0);
+        if (firstOnly) {
+            return result->count;
+        }
+    }
+
+    for (i=0; i < size; i++) {
+        size_t left = size - i;
+        const char* p = data + i;
+
+        uint32_t j = matcher->shortStart[(unsigned char) *p];
+        uint32_t last = matcher->shortStart[(unsigned char) *p + 1];
+        for (; j < last; j++) {
+            uint32_t term = matcher->shortTerms[j];
+            uint32_t length = matcher->lengths[term];
+            if (length <= left && memcmp(p, matcher->pool +
+                    matcher->offsets[term], length) == 0) {
+                if (!matcher_report(result, term, i) || firstOnly) {
+                    return result->count;
+                }
+            }
+        }
+
+        if (left < MATCHER_GRAM) {
+            continue;
+        }
+        uint32_t key = matcher_key(p);
+        uint32_t bucket = matcher_bucket(matcher, key);
+        if (!(matcher->filter[bucket / 64] & ((uint64_t) 1 << (bucket % 64)))) {
+            continue;
+        }
+        // Probe the table with the hash of the input for every length
+        // of the terms with this gram, so the cost does not depend on
+        // how many terms share it.
+        uint64_t hash = MATCHER_HASH_INIT;
+        size_t hashed = 0;
+        size_t mask = ((size_t) 1 << matcher->tableBits) - 1;
+        last = matcher->bucketStart[bucket + 1];
+        for (j=matcher->bucketStart[bucket]; j < last; j++) {
+            if (matcher->bucketKeys[j] != key) {
+                continue;
+            }
+            uint32_t length = matcher->bucketLengths[j];
+            if (length > left) {
+                break;
+            }
+            hash = matcher_hash(hash, p + hashed, length - hashed);
+            hashed = length;
+            size_t slot = hash & mask;
+            uint32_t term;
+            while ((term = matcher->tableTerms[slot]) != UINT32_MAX) {
+                if (matcher->tableHashes[slot] == hash &&
+                        matcher->lengths[term] == length &&
+                        memcmp(p + MATCHER_GRAM, matcher->pool +
+                               matcher->offsets[term] + MATCHER_GRAM,
+                               length - MATCHER_GRAM) == 0) {
+                    if (!matcher_report(result, term, i) || firstOnly) {
+                        return result->count;
+                    }
+                }
+                slot = (slot + 1) & mask;
+            }
+        }
+    }
+    return result->count;
+}
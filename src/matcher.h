@@ -0,0 +1,143 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef MATCHER_H__
+#define MATCHER_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+
+    #include "dumpfilter.h"
+    #include "memory.h"
+
+    /**
+     * The number of leading bytes of a term that are hashed. Shorter
+     * terms are looked up by their first byte instead.
+     */
+    #define MATCHER_GRAM 4
+
+    /**
+     * A set of search terms that can be located in a block of memory
+     * in a single call. Terms are identified by the order in which they
+     * have been added, starting at zero. After `matcher_compile()` was
+     * called, the matcher is not modified by scanning and can be shared.
+     *
+     * Compiled terms are bucketed by a hash of their first
+     * `MATCHER_GRAM` bytes. While scanning, the gram at every position
+     * is looked up in a bitmap of the non-empty buckets. For a hit
+     * bucket, a table of the whole terms is probed once for every
+     * length of the terms with that gram, so terms with a common prefix
+     * ("http", "www.") are not compared one by one. The cost per scanned
+     * byte stays almost the same for a handful or millions of terms.
+     */
+    struct matcher;
+
+    typedef struct matcher matcher_t;
+
+    /**
+     * A search term that was found in a block of memory. The offset is
+     * relative to the start of the block. This is the hit type of the
+     * public API, so hits are passed on without a copy.
+     */
+    typedef struct dumpfilter_hit matcher_hit_t;
+
+    /**
+     * The hits of a `matcher_scan()` call. Each term is reported once
+     * with its first occurence. Allocate one per thread with
+     * `matcher_result_alloc()`.
+     */
+    struct matcher_result {
+        matcher_hit_t* hits;
+        size_t count;
+
+        // Internal, used to report every term only once.
+        size_t capacity;
+        uint32_t* stamps;
+        uint32_t generation;
+    };
+
+    typedef struct matcher_result matcher_result_t;
+
+    /**
+     * Allocate a new empty matcher. Returns NULL on failure.
+     */
+    matcher_t* matcher_alloc(void);
+
+    /**
+     * Free the matcher and all terms it holds.
+     */
+    void matcher_free(matcher_t* matcher);
+
+    /**
+     * Add a copy of the passed term to the matcher. Returns false on a
+     * memory error or if the matcher was already compiled.
+     */
+    bool matcher_add(matcher_t* matcher, const char* term, size_t length);
+
+    /**
+     * Add every line of the file *filename* as a term. Line endings are
+     * stripped and empty lines are skipped. If *outCount* is not a null
+     * pointer, it is assigned the number of terms that have been added.
+     * Returns false if the file could not be read or on a memory error.
+     */
+    bool matcher_add_file(
+            matcher_t* matcher, const char* filename, size_t* outCount);
+
+    /**
+     * Returns the number of terms in the matcher.
+     */
+    size_t matcher_count(const matcher_t* matcher);
+
+    /**
+     * Returns the term with the passed index and assigns its length to
+     * *outLength* if it is not a null pointer.
+     */
+    const char* matcher_term(
+            const matcher_t* matcher, uint32_t term, size_t* outLength);
+
+    /**
+     * Prepare the matcher for scanning. No terms can be added after
+     * this function was called. Returns false on a memory error.
+     */
+    bool matcher_compile(matcher_t* matcher);
+
+    /**
+     * Allocate a result that can hold the hits of every term of the
+     * compiled *matcher*. Returns NULL on failure.
+     */
+    matcher_result_t* matcher_result_alloc(const matcher_t* matcher);
+
+    /**
+     * Free a result allocated with `matcher_result_alloc()`.
+     */
+    void matcher_result_free(matcher_result_t* result);
+
+    /**
+     * Search the memory block for the terms of the matcher and fill
+     * *result* with the first occurence of every term that was found.
+     * If *firstOnly* is true, the search stops at the first hit.
+     * Returns the number of hits.
+     */
+    size_t matcher_scan(
+            const matcher_t* matcher, matcher_result_t* result,
+            const char* data, size_t size, bool firstOnly);
+
+#endif /* MATCHER_H__ */
@@ -20,10 +20,21 @@
 
 #include "memory.h"
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
 #ifdef DEBUG
 
+    #include <pthread.h>
+
     _memory_node_t* _shiney_memory_start = NULL;
 
+    // Protects the list of nodes, memory is allocated by multiple
+    // threads.
+    static pthread_mutex_t _memory_lock = PTHREAD_MUTEX_INITIALIZER;
+
     void* _allocate(size_t size, size_t line, const char* filename) {
         size_t newSize = sizeof(_memory_node_t) + size;
         _memory_node_t* node = malloc(newSize);
@@ -37,11 +48,13 @@
         node->line = line;
         node->filename = filename;
         node->prev = NULL;
+        pthread_mutex_lock(&_memory_lock);
         node->next = _shiney_memory_start;
         if (_shiney_memory_start) {
             _shiney_memory_start->prev = node;
         }
         _shiney_memory_start = node;
+        pthread_mutex_unlock(&_memory_lock);
 
         return ((char*) node) + sizeof(_memory_node_t);
     }
@@ -50,12 +63,14 @@
         _memory_node_t* node = (void*) (((char*) ptr) - sizeof(_memory_node_t));
 
         // Search for the node in the allocated nodes list.
+        pthread_mutex_lock(&_memory_lock);
         _memory_node_t* current = _shiney_memory_start;
         while (current && current != node) {
             current = current->next;
         }
 
         if (!current) {
+            pthread_mutex_unlock(&_memory_lock);
             fprintf(stderr, "%s:%lu Attempt to deallocate memory block not "
                     "allocated with shiney_alloc().\n", filename,
                     (unsigned long) line);
@@ -72,17 +87,69 @@
         if (current == _shiney_memory_start) {
             _shiney_memory_start = current->next;
         }
+        pthread_mutex_unlock(&_memory_lock);
 
         free(current);
     }
 
+    void* _reallocate(void* ptr, size_t size, size_t line,
+                      const char* filename) {
+        if (!ptr) {
+            return _allocate(size, line, filename);
+        }
+
+        _memory_node_t* node = (void*) (((char*) ptr) - sizeof(_memory_node_t));
+
+        // Search for the node in the allocated nodes list.
+        pthread_mutex_lock(&_memory_lock);
+        _memory_node_t* current = _shiney_memory_start;
+        while (current && current != node) {
+            current = current->next;
+        }
+
+        if (!current) {
+            pthread_mutex_unlock(&_memory_lock);
+            fprintf(stderr, "%s:%lu Attempt to reallocate memory block not "
+                    "allocated with shiney_alloc().\n", filename,
+                    (unsigned long) line);
+            return NULL;
+        }
+
+        _memory_node_t* moved = realloc(current, sizeof(_memory_node_t) + size);
+        if (!moved) {
+            pthread_mutex_unlock(&_memory_lock);
+            fprintf(stderr, "%s:%lu Failed to reallocate %lu bytes.\n",
+                    filename, (unsigned long) line, (unsigned long) size);
+            return NULL;
+        }
+
+        // Update the neighbours, the node may have been moved.
+        moved->size = size;
+        moved->line = line;
+        moved->filename = filename;
+        if (moved->prev) {
+            moved->prev->next = moved;
+        }
+        else {
+            _shiney_memory_start = moved;
+        }
+        if (moved->next) {
+            moved->next->prev = moved;
+        }
+        pthread_mutex_unlock(&_memory_lock);
+
+        return ((char*) moved) + sizeof(_memory_node_t);
+    }
+
     void memory_info(FILE* fp) {
+        pthread_mutex_lock(&_memory_lock);
         _memory_node_t* node = _shiney_memory_start;
         while (node) {
             fprintf(fp, "%s:%lu (%lu bytes)\n", node->filename,
                     (unsigned long) node->line, (unsigned long) node->size);
             node = node->next;
         }
+        pthread_mutex_unlock(&_memory_lock);
     }
 
 #else
@@ -95,7 +162,148 @@
         free(ptr);
     }
 
+    void* reallocate(void* ptr, size_t size) {
+        return realloc(ptr, size);
+    }
+
     void memory_info(FILE* fp) {
     }
 
 #endif /* DEBUG */
+
+// The kind of pages for large blocks, the size of a huge page and the
+// number of bytes mapped with each kind of pages.
+static int memoryPages = MEMORY_PAGES_NORMAL;
+static size_t memoryHugeSize = 2 * 1024 * 1024;
+static uint64_t memoryHugetlbBytes = 0;
+static uint64_t memoryTransparentBytes = 0;
+static uint64_t memoryNormalBytes = 0;
+
+int memory_parse_pages(const char* name) {
+    if (strcmp(name, "normal") == 0) {
+        return MEMORY_PAGES_NORMAL;
+    }
+    if (strcmp(name, "transparent") == 0) {
+        return MEMORY_PAGES_TRANSPARENT;
+    }
+    if (strcmp(name, "hugetlb") == 0) {
+        return MEMORY_PAGES_HUGETLB;
+    }
+    return -1;
+}
+
+void memory_set_pages(int pages) {
+    memoryPages = pages;
+    if (pages == MEMORY_PAGES_NORMAL) {
+        return;
+    }
+    // MAP_HUGETLB uses the default huge page size of the system.
+    FILE* fp = fopen("/proc/meminfo", "r");
+    if (fp) {
+        char line[128];
+        unsigned long size;
+        while (fgets(line, sizeof(line), fp)) {
+            if (sscanf(line, "Hugepagesize: %lu kB", &size) == 1 && size > 0) {
+                memoryHugeSize = size * 1024;
+                break;
+            }
+        }
+        fclose(fp);
+    }
+}
+
+/**
+ * Returns true if a block of *size* bytes is placed on huge pages.
+ */
+static bool memory_huge(size_t size) {
+    return memoryPages != MEMORY_PAGES_NORMAL && size >= memoryHugeSize / 2;
+}
+
+/**
+ * Returns the number of bytes that are actually mapped for a block of
+ * *size* bytes. Blocks on huge pages are whole huge pages.
+ */
+static size_t memory_mapped_size(size_t size) {
+    if (!memory_huge(size)) {
+        return size;
+    }
+    return (size + memoryHugeSize - 1) / memoryHugeSize * memoryHugeSize;
+}
+
+/**
+ * Map *size* bytes aligned to a huge page, so the kernel can back them
+ * with transparent huge pages.
+ */
+static void* memory_map_transparent(size_t size) {
+    size_t mapSize = size + memoryHugeSize;
+    char* map = mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    char* ptr = map + (memoryHugeSize - (uintptr_t) map % memoryHugeSize) % memoryHugeSize;
+    if (ptr > map) {
+        munmap(map, ptr - map);
+    }
+    if (map + mapSize > ptr + size) {
+        munmap(ptr + size, map + mapSize - (ptr + size));
+    }
+    #ifdef MADV_HUGEPAGE
+        if (madvise(ptr, size, MADV_HUGEPAGE) == 0) {
+            __atomic_add_fetch(&memoryTransparentBytes, size, __ATOMIC_RELAXED);
+            return ptr;
+        }
+    #endif
+    __atomic_add_fetch(&memoryNormalBytes, size, __ATOMIC_RELAXED);
+    return ptr;
+}
+
+void* allocate_pages(size_t size) {
+    void* ptr = NULL;
+    if (memory_huge(size)) {
+        size_t mapSize = memory_mapped_size(size);
+        #ifdef MAP_HUGETLB
+            if (memoryPages == MEMORY_PAGES_HUGETLB) {
+                ptr = mmap(NULL, mapSize, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (ptr == MAP_FAILED) {
+                    ptr = NULL;
+                }
+                else {
+                    __atomic_add_fetch(&memoryHugetlbBytes, mapSize, __ATOMIC_RELAXED);
+                }
+            }
+        #endif
+        if (!ptr) {
+            ptr = memory_map_transparent(mapSize);
+        }
+    }
+    else {
+        ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            ptr = NULL;
+        }
+        else {
+            __atomic_add_fetch(&memoryNormalBytes, size, __ATOMIC_RELAXED);
+        }
+    }
+    if (!ptr) {
+        fprintf(stderr, "Failed to map %lu bytes.\n", (unsigned long) size);
+    }
+    return ptr;
+}
+
+void deallocate_pages(void* ptr, size_t size) {
+    if (ptr) {
+        munmap(ptr, memory_mapped_size(size));
+    }
+}
+
+void memory_page_info(FILE* fp) {
+    fprintf(fp, "Buffers on huge pages:  %llu (reserved), %llu (transparent)\n",
+            (unsigned long long) __atomic_load_n(&memoryHugetlbBytes, __ATOMIC_RELAXED),
+            (unsigned long long) __atomic_load_n(&memoryTransparentBytes, __ATOMIC_RELAXED));
+    fprintf(fp, "Buffers on other pages: %llu\n",
+            (unsigned long long) __atomic_load_n(&memoryNormalBytes, __ATOMIC_RELAXED));
+}
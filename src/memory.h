@@ -44,17 +44,73 @@
 
         void _deallocate(void* ptr, size_t line, const char* filename);
 
+        void* _reallocate(void* ptr, size_t size, size_t line,
+                          const char* filename);
+
         #define allocate(size) _allocate((size), __LINE__, __FILE__)
 
         #define deallocate(ptr) _deallocate((ptr), __LINE__, __FILE__)
 
+        #define reallocate(ptr, size) \
+            _reallocate((ptr), (size), __LINE__, __FILE__)
+
     #else
 
         void* allocate(size_t size);
         void deallocate(void* ptr);
 
+        /**
+         * Resize a memory block allocated with `allocate()`. Behaves
+         * like `realloc()`: on failure, NULL is returned and the
+         * original block is left untouched.
+         */
+        void* reallocate(void* ptr, size_t size);
+
     #endif /* DEBUG */
 
+    /**
+     * The kinds of pages `allocate_pages()` can use for large blocks:
+     * normal pages, transparent huge pages (`MADV_HUGEPAGE`) or huge
+     * pages reserved by the system (`MAP_HUGETLB`).
+     */
+    #define MEMORY_PAGES_NORMAL 0
+    #define MEMORY_PAGES_TRANSPARENT 1
+    #define MEMORY_PAGES_HUGETLB 2
+
+    /**
+     * Returns the kind of pages with the passed name ("normal",
+     * "transparent" or "hugetlb"), or -1 if the name is unknown.
+     */
+    int memory_parse_pages(const char* name);
+
+    /**
+     * Back blocks of at least half a huge page allocated with
+     * `allocate_pages()` with the passed kind of pages. Blocks that can
+     * not get reserved huge pages fall back to transparent huge pages,
+     * and those to normal pages. Must be called before the first call
+     * to `allocate_pages()`.
+     */
+    void memory_set_pages(int pages);
+
+    /**
+     * Allocate *size* bytes of zeroed memory aligned to the page size,
+     * suitable as a buffer for large reads. These blocks are not
+     * tracked in debug builds. Returns NULL on failure.
+     */
+    void* allocate_pages(size_t size);
+
+    /**
+     * Free a block allocated with `allocate_pages()`. *size* must be the
+     * size that was passed to `allocate_pages()`.
+     */
+    void deallocate_pages(void* ptr, size_t size);
+
+    /**
+     * Print how many bytes `allocate_pages()` placed on which kind of
+     * pages.
+     */
+    void memory_page_info(FILE* fp);
+
     void memory_info(FILE* fp);
 
 #endif /* MEMORY_H__ */
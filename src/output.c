@@ -0,0 +1,477 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "output.h"
+#include "blockqueue.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+    #include <zstd.h>
+#endif
+
+// The amount of uncompressed data per block. Every block is compressed
+// independently, so larger blocks compress better.
+#define OUTPUT_BLOCK_SIZE (1024 * 1024)
+
+#define OUTPUT_MAX_THREADS 64
+
+struct output {
+    FILE* fp;
+    int format;
+    int level;
+    bool error;
+
+    // Compressed outputs only. The block that is filled and the
+    // uncompressed data of all blocks in flight, indexed by their
+    // sequence number modulo the queue depth.
+    blockqueue_t* queue;
+    size_t depth;
+    char** raw;
+    size_t* rawSize;
+    blockqueue_block_t** blocks;
+    uint64_t fillSeq;
+    bool filling;
+
+    // The workers compress the blocks from *compressSeq* to *fillSeq*,
+    // the writer has written the blocks before *writeSeq*.
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint64_t compressSeq;
+    uint64_t writeSeq;
+    bool closing;
+    pthread_t workers[OUTPUT_MAX_THREADS];
+    int workerCount;
+    pthread_t writer;
+    bool writerStarted;
+};
+
+int output_parse(const char* name) {
+    if (strcmp(name, "none") == 0) {
+        return OUTPUT_PLAIN;
+    }
+    if (strcmp(name, "gzip") == 0) {
+        return OUTPUT_GZIP;
+    }
+    if (strcmp(name, "zstd") == 0) {
+        return OUTPUT_ZSTD;
+    }
+    return -1;
+}
+
+bool output_supported(int format) {
+    #ifdef HAVE_ZSTD
+        (void) format;
+        return true;
+    #else
+        return format != OUTPUT_ZSTD;
+    #endif
+}
+
+/**
+ * Compress *size* bytes of *data* into *block* as one gzip member.
+ */
+static bool output_deflate(
+        z_stream* stream, blockqueue_block_t* block,
+        const char* data, size_t size) {
+    if (!blockqueue_reserve(block, deflateBound(stream, size) + 64)) {
+        return false;
+    }
+    deflateReset(stream);
+    stream->next_in = (unsigned char*) data;
+    stream->avail_in = size;
+    stream->next_out = (unsigned char*) block->data;
+    stream->avail_out = block->capacity;
+    if (deflate(stream, Z_FINISH) != Z_STREAM_END) {
+        return false;
+    }
+    block->size = block->capacity - stream->avail_out;
+    return true;
+}
+
+static void* output_worker(void* arg) {
+    output_t* output = arg;
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    int level = output->level ? output->level : Z_DEFAULT_COMPRESSION;
+    bool ok = deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8,
+                           Z_DEFAULT_STRATEGY) == Z_OK;
+    #ifdef HAVE_ZSTD
+        ZSTD_CCtx* context = ZSTD_createCCtx();
+        ok &= context != NULL;
+        if (context && output->level) {
+            ZSTD_CCtx_setParameter(context, ZSTD_c_compressionLevel,
+                                   output->level);
+        }
+    #endif
+
+    pthread_mutex_lock(&output->lock);
+    for (;;) {
+        while (!output->closing && output->compressSeq >= output->fillSeq) {
+            pthread_cond_wait(&output->changed, &output->lock);
+        }
+        if (output->compressSeq >= output->fillSeq) {
+            break;
+        }
+        uint64_t seq = output->compressSeq++;
+        pthread_mutex_unlock(&output->lock);
+
+        size_t slot = seq % output->depth;
+        blockqueue_block_t* block = output->blocks[slot];
+        const char* data = output->raw[slot];
+        size_t size = output->rawSize[slot];
+        bool compressed = false;
+        if (ok && output->format == OUTPUT_GZIP) {
+            compressed = output_deflate(&stream, block, data, size);
+        }
+        #ifdef HAVE_ZSTD
+            if (ok && output->format == OUTPUT_ZSTD &&
+                    blockqueue_reserve(block, ZSTD_compressBound(size))) {
+                size_t ret = ZSTD_compress2(context, block->data,
+                        block->capacity, data, size);
+                compressed = !ZSTD_isError(ret);
+                block->size = compressed ? ret : 0;
+            }
+        #endif
+        if (!compressed) {
+            block->size = 0;
+        }
+
+        pthread_mutex_lock(&output->lock);
+        output->error |= !compressed;
+        pthread_mutex_unlock(&output->lock);
+        blockqueue_submit(output->queue, seq);
+        pthread_mutex_lock(&output->lock);
+    }
+    pthread_mutex_unlock(&output->lock);
+
+    deflateEnd(&stream);
+    #ifdef HAVE_ZSTD
+        ZSTD_freeCCtx(context);
+    #endif
+    return NULL;
+}
+
+static void* output_writer(void* arg) {
+    output_t* output = arg;
+    blockqueue_block_t* block;
+    while ((block = blockqueue_next(output->queue))) {
+        bool written = fwrite(block->data, 1, block->size, output->fp) ==
+                       block->size;
+        blockqueue_release(output->queue);
+        pthread_mutex_lock(&output->lock);
+        if (!written) {
+            output->error = true;
+        }
+        output->writeSeq++;
+        pthread_cond_broadcast(&output->changed);
+        pthread_mutex_unlock(&output->lock);
+    }
+    return NULL;
+}
+
+/**
+ * Claim the next block if none is being filled. Returns false if
+ * the output can not take more data.
+ */
+static bool output_prepare(output_t* output) {
+    if (output->filling) {
+        return true;
+    }
+    uint64_t seq;
+    blockqueue_block_t* block = blockqueue_claim(output->queue, &seq);
+    if (!block) {
+        return false;
+    }
+    output->blocks[seq % output->depth] = block;
+    output->rawSize[seq % output->depth] = 0;
+    output->filling = true;
+    return true;
+}
+
+/**
+ * Hand the block that is being filled to the workers.
+ */
+static void output_submit(output_t* output) {
+    if (!output->filling) {
+        return;
+    }
+    output->filling = false;
+    pthread_mutex_lock(&output->lock);
+    output->fillSeq++;
+    pthread_cond_broadcast(&output->changed);
+    pthread_mutex_unlock(&output->lock);
+}
+
+/**
+ * Open the output. If *resume* is true, an existing file is truncated
+ * to *size* bytes and continued.
+ */
+static output_t* output_start(const char* path, int format, int level,
+                              int threads, bool resume, uint64_t size) {
+    if (!output_supported(format)) {
+        return NULL;
+    }
+
+    output_t* output = allocate(sizeof(output_t));
+    if (!output) {
+        return NULL;
+    }
+    memset(output, 0, sizeof(output_t));
+    output->format = format;
+    output->level = level;
+    pthread_mutex_init(&output->lock, NULL);
+    pthread_cond_init(&output->changed, NULL);
+
+    if (path && strcmp(path, "-") != 0) {
+        output->fp = fopen(path, resume ? "r+b" : "wb");
+    }
+    else if (!resume) {
+        output->fp = stdout;
+    }
+    if (!output->fp) {
+        output_close(output);
+        return NULL;
+    }
+    if (resume && (ftruncate(fileno(output->fp), size) != 0 ||
+            fseeko(output->fp, 0, SEEK_END) != 0)) {
+        output_close(output);
+        return NULL;
+    }
+    if (format == OUTPUT_PLAIN) {
+        return output;
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (threads > OUTPUT_MAX_THREADS) {
+        threads = OUTPUT_MAX_THREADS;
+    }
+    output->depth = threads * 2 + 2;
+    output->queue = blockqueue_alloc(output->depth, OUTPUT_BLOCK_SIZE);
+    output->raw = allocate(sizeof(char*) * output->depth);
+    output->rawSize = allocate(sizeof(size_t) * output->depth);
+    output->blocks = allocate(sizeof(blockqueue_block_t*) * output->depth);
+    if (!output->queue || !output->raw || !output->rawSize ||
+            !output->blocks) {
+        output_close(output);
+        return NULL;
+    }
+    memset(output->raw, 0, sizeof(char*) * output->depth);
+    size_t i;
+    for (i=0; i < output->depth; i++) {
+        output->raw[i] = allocate_pages(OUTPUT_BLOCK_SIZE);
+        if (!output->raw[i]) {
+            output_close(output);
+            return NULL;
+        }
+    }
+
+    if (pthread_create(&output->writer, NULL, output_writer, output) != 0) {
+        output_close(output);
+        return NULL;
+    }
+    output->writerStarted = true;
+    int j;
+    for (j=0; j < threads; j++) {
+        if (pthread_create(&output->workers[j], NULL, output_worker,
+                           output) != 0) {
+            break;
+        }
+        output->workerCount++;
+    }
+    if (output->workerCount == 0) {
+        output_close(output);
+        return NULL;
+    }
+    return output;
+}
+
+output_t* output_open(const char* path, int format, int level,
+                      int threads) {
+    return output_start(path, format, level, threads, false, 0);
+}
+
+output_t* output_resume(const char* path, int format, int level,
+                        int threads, uint64_t size) {
+    return output_start(path, format, level, threads, true, size);
+}
+
+bool output_write(output_t* output, const void* data, size_t size) {
+    if (output->format == OUTPUT_PLAIN) {
+        if (fwrite(data, 1, size, output->fp) != size) {
+            output->error = true;
+        }
+        return !output->error;
+    }
+
+    const char* p = data;
+    while (size > 0) {
+        if (!output_prepare(output)) {
+            output->error = true;
+            return false;
+        }
+        size_t slot = output->fillSeq % output->depth;
+        size_t count = OUTPUT_BLOCK_SIZE - output->rawSize[slot];
+        if (count > size) {
+            count = size;
+        }
+        memcpy(output->raw[slot] + output->rawSize[slot], p, count);
+        output->rawSize[slot] += count;
+        p += count;
+        size -= count;
+        if (output->rawSize[slot] == OUTPUT_BLOCK_SIZE) {
+            output_submit(output);
+        }
+    }
+
+    pthread_mutex_lock(&output->lock);
+    bool error = output->error;
+    pthread_mutex_unlock(&output->lock);
+    return !error;
+}
+
+bool output_printf(output_t* output, const char* format, ...) {
+    char buffer[256];
+    va_list ap;
+    va_start(ap, format);
+    int length = vsnprintf(buffer, sizeof(buffer), format, ap);
+    va_end(ap);
+    if (length < 0) {
+        return false;
+    }
+    if ((size_t) length < sizeof(buffer)) {
+        return output_write(output, buffer, length);
+    }
+
+    char* text = allocate(length + 1);
+    if (!text) {
+        return false;
+    }
+    va_start(ap, format);
+    vsnprintf(text, length + 1, format, ap);
+    va_end(ap);
+    bool result = output_write(output, text, length);
+    deallocate(text);
+    return result;
+}
+
+bool output_flush(output_t* output) {
+    if (output->format == OUTPUT_PLAIN) {
+        if (fflush(output->fp) != 0) {
+            output->error = true;
+        }
+        return !output->error;
+    }
+    output_submit(output);
+    pthread_mutex_lock(&output->lock);
+    bool error = output->error;
+    pthread_mutex_unlock(&output->lock);
+    return !error;
+}
+
+bool output_sync(output_t* output, uint64_t* outSize) {
+    if (!output_flush(output)) {
+        return false;
+    }
+    if (output->queue) {
+        pthread_mutex_lock(&output->lock);
+        while (output->writeSeq < output->fillSeq && !output->error) {
+            pthread_cond_wait(&output->changed, &output->lock);
+        }
+        bool error = output->error;
+        pthread_mutex_unlock(&output->lock);
+        if (error) {
+            return false;
+        }
+    }
+    if (output->fp == stdout || fflush(output->fp) != 0 ||
+            fsync(fileno(output->fp)) != 0) {
+        return false;
+    }
+    off_t size = ftello(output->fp);
+    if (size < 0) {
+        return false;
+    }
+    *outSize = size;
+    return true;
+}
+
+bool output_close(output_t* output) {
+    if (output->queue) {
+        // An empty file is not a valid compressed stream, write at least
+        // one (empty) block.
+        if (output->fillSeq == 0 && output->workerCount > 0) {
+            output_prepare(output);
+        }
+        output_submit(output);
+
+        // Let the workers compress the remaining blocks, then wait for
+        // the writer to write them.
+        pthread_mutex_lock(&output->lock);
+        output->closing = true;
+        pthread_cond_broadcast(&output->changed);
+        pthread_mutex_unlock(&output->lock);
+        int i;
+        for (i=0; i < output->workerCount; i++) {
+            pthread_join(output->workers[i], NULL);
+        }
+        blockqueue_finish(output->queue, false);
+        if (output->writerStarted) {
+            pthread_join(output->writer, NULL);
+        }
+    }
+
+    bool result = !output->error;
+    if (output->fp && fflush(output->fp) != 0) {
+        result = false;
+    }
+    if (output->fp && output->fp != stdout && fclose(output->fp) != 0) {
+        result = false;
+    }
+
+    if (output->raw) {
+        size_t i;
+        for (i=0; i < output->depth; i++) {
+            deallocate_pages(output->raw[i], OUTPUT_BLOCK_SIZE);
+        }
+        deallocate(output->raw);
+    }
+    if (output->rawSize) {
+        deallocate(output->rawSize);
+    }
+    if (output->blocks) {
+        deallocate(output->blocks);
+    }
+    blockqueue_free(output->queue);
+    pthread_mutex_destroy(&output->lock);
+    pthread_cond_destroy(&output->changed);
+    deallocate(output);
+    return result;
+}
@@ -0,0 +1,106 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef OUTPUT_H__
+#define OUTPUT_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <stdio.h>
+
+    #include "memory.h"
+
+    #define OUTPUT_PLAIN 0
+    #define OUTPUT_GZIP 1
+    #define OUTPUT_ZSTD 2
+
+    /**
+     * A file the results are written to. Plain outputs are written
+     * through stdio. Compressed outputs collect the data in blocks that
+     * are compressed by worker threads; every block becomes a complete
+     * gzip member or zstd frame and is written in order by a writer
+     * thread, so the file is a valid stream that can be concatenated
+     * with others.
+     */
+    struct output;
+
+    typedef struct output output_t;
+
+    /**
+     * Returns the format with the passed name ("none", "gzip" or
+     * "zstd"), or -1 if the name is unknown.
+     */
+    int output_parse(const char* name);
+
+    /**
+     * Returns true if the format can be written by this build.
+     */
+    bool output_supported(int format);
+
+    /**
+     * Open *path* for writing. If *path* is NULL or "-", the standard
+     * output is used. *level* is the compression level, zero selects
+     * the default of the format. Up to *threads* threads compress the
+     * data. Returns NULL on failure.
+     */
+    output_t* output_open(const char* path, int format, int level,
+                          int threads);
+
+    /**
+     * Continue the output file at *path* that was written up to *size*
+     * bytes before, see `output_sync()`. Data after that is discarded.
+     * Returns NULL on failure.
+     */
+    output_t* output_resume(const char* path, int format, int level,
+                            int threads, uint64_t size);
+
+    /**
+     * Write *size* bytes to the output. Returns false if an error
+     * occured while writing the output.
+     */
+    bool output_write(output_t* output, const void* data, size_t size);
+
+    /**
+     * Write formatted text to the output, see `output_write()`.
+     */
+    bool output_printf(output_t* output, const char* format, ...);
+
+    /**
+     * Pass all data written so far to the file. Compressed outputs end
+     * the current block early.
+     */
+    bool output_flush(output_t* output);
+
+    /**
+     * Write all data written so far to the disk and assign the size of
+     * the file to *outSize*. Returns false on failure or if the output
+     * is the standard output.
+     */
+    bool output_sync(output_t* output, uint64_t* outSize);
+
+    /**
+     * Write the remaining data and close the output. The standard
+     * output is only flushed. Returns false if an error occured at any
+     * time while writing.
+     */
+    bool output_close(output_t* output);
+
+#endif /* OUTPUT_H__ */
@@ -0,0 +1,226 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "pool.h"
+
+#include <pthread.h>
+#include <string.h>
+
+struct pool_task {
+    pool_fn fn;
+    void* arg;
+};
+
+struct pool_deque {
+    pthread_mutex_t lock;
+    struct pool_task* tasks;
+    size_t head;
+    size_t tail;
+    size_t capacity;
+};
+
+struct pool_worker {
+    pool_t* pool;
+    int index;
+    pthread_t thread;
+    bool started;
+};
+
+struct pool {
+    int workerCount;
+    struct pool_worker* workers;
+    struct pool_deque* deques;
+    int next;
+
+    // Workers sleep on *wake* until a task was queued that no other
+    // worker has reserved yet.
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    size_t queued;
+    bool stop;
+};
+
+static bool pool_deque_push(struct pool_deque* deque, pool_fn fn, void* arg) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail == deque->capacity) {
+        // Move the remaining tasks to the front before growing.
+        size_t count = deque->tail - deque->head;
+        if (deque->head > 0) {
+            memmove(deque->tasks, deque->tasks + deque->head,
+                    sizeof(struct pool_task) * count);
+            deque->head = 0;
+            deque->tail = count;
+        }
+        if (deque->tail == deque->capacity) {
+            size_t capacity = deque->capacity ? deque->capacity * 2 : 64;
+            struct pool_task* tasks = reallocate(deque->tasks,
+                    sizeof(struct pool_task) * capacity);
+            if (!tasks) {
+                pthread_mutex_unlock(&deque->lock);
+                return false;
+            }
+            deque->tasks = tasks;
+            deque->capacity = capacity;
+        }
+    }
+    deque->tasks[deque->tail].fn = fn;
+    deque->tasks[deque->tail].arg = arg;
+    deque->tail++;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+static bool pool_deque_take(struct pool_deque* deque, bool steal,
+                            struct pool_task* task) {
+    bool found = false;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) {
+        if (steal) {
+            *task = deque->tasks[--deque->tail];
+        }
+        else {
+            *task = deque->tasks[deque->head++];
+        }
+        found = true;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static void* pool_run(void* arg) {
+    struct pool_worker* worker = arg;
+    pool_t* pool = worker->pool;
+    for (;;) {
+        // Reserve one of the queued tasks. It is guaranteed to be in
+        // one of the deques until it is taken.
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->wake, &pool->lock);
+        }
+        if (pool->queued == 0) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        pool->queued--;
+        pthread_mutex_unlock(&pool->lock);
+
+        struct pool_task task;
+        bool found = pool_deque_take(&pool->deques[worker->index], false, &task);
+        int i = worker->index;
+        while (!found) {
+            i = (i + 1) % pool->workerCount;
+            found = pool_deque_take(&pool->deques[i], true, &task);
+        }
+        task.fn(task.arg, worker->index);
+    }
+    return NULL;
+}
+
+pool_t* pool_alloc(int workers) {
+    if (workers < 1) {
+        workers = 1;
+    }
+    pool_t* pool = allocate(sizeof(pool_t));
+    if (!pool) {
+        return NULL;
+    }
+    memset(pool, 0, sizeof(pool_t));
+    pool->workerCount = workers;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wake, NULL);
+
+    pool->workers = allocate(sizeof(struct pool_worker) * workers);
+    pool->deques = allocate(sizeof(struct pool_deque) * workers);
+    if (!pool->workers || !pool->deques) {
+        if (pool->workers) {
+            deallocate(pool->workers);
+        }
+        if (pool->deques) {
+            deallocate(pool->deques);
+        }
+        deallocate(pool);
+        return NULL;
+    }
+    memset(pool->workers, 0, sizeof(struct pool_worker) * workers);
+    memset(pool->deques, 0, sizeof(struct pool_deque) * workers);
+
+    int i;
+    for (i=0; i < workers; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+    }
+    for (i=0; i < workers; i++) {
+        struct pool_worker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        if (pthread_create(&worker->thread, NULL, pool_run, worker) != 0) {
+            pool_free(pool);
+            return NULL;
+        }
+        worker->started = true;
+    }
+    return pool;
+}
+
+void pool_free(pool_t* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+
+    int i;
+    for (i=0; i < pool->workerCount; i++) {
+        if (pool->workers[i].started) {
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+    }
+    for (i=0; i < pool->workerCount; i++) {
+        struct pool_deque* deque = &pool->deques[i];
+        if (deque->tasks) {
+            deallocate(deque->tasks);
+        }
+        pthread_mutex_destroy(&deque->lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->wake);
+    deallocate(pool->workers);
+    deallocate(pool->deques);
+    deallocate(pool);
+}
+
+int pool_workers(const pool_t* pool) {
+    return pool->workerCount;
+}
+
+bool pool_submit(pool_t* pool, int worker, pool_fn fn, void* arg) {
+    if (worker < 0 || worker >= pool->workerCount) {
+        pthread_mutex_lock(&pool->lock);
+        worker = pool->next;
+        pool->next = (pool->next + 1) % pool->workerCount;
+        pthread_mutex_unlock(&pool->lock);
+    }
+    if (!pool_deque_push(&pool->deques[worker], fn, arg)) {
+        return false;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_signal(&pool->wake);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
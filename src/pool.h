@@ -0,0 +1,68 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef POOL_H__
+#define POOL_H__
+
+    #include <stdbool.h>
+    #include <stddef.h>
+
+    #include "memory.h"
+
+    /**
+     * A task of the pool. *worker* is the index of the thread that runs
+     * it, so tasks can use per-worker state without locking.
+     */
+    typedef void (*pool_fn)(void* arg, int worker);
+
+    /**
+     * A fixed set of worker threads with one task deque each. Workers
+     * run the tasks of their own deque in the order they were queued
+     * and steal from the back of the other deques when theirs is
+     * empty, so long tasks on one worker do not hold back the tasks
+     * queued behind them.
+     */
+    struct pool;
+
+    typedef struct pool pool_t;
+
+    /**
+     * Start a pool with *workers* threads. Returns NULL on failure.
+     */
+    pool_t* pool_alloc(int workers);
+
+    /**
+     * Wait until all submitted tasks are done, then stop the workers
+     * and free the pool.
+     */
+    void pool_free(pool_t* pool);
+
+    /**
+     * Returns the number of worker threads.
+     */
+    int pool_workers(const pool_t* pool);
+
+    /**
+     * Queue a task on the deque of *worker*, or distribute the tasks
+     * round-robin if it is -1. Returns false on failure.
+     */
+    bool pool_submit(pool_t* pool, int worker, pool_fn fn, void* arg);
+
+#endif /* POOL_H__ */
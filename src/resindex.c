@@ -0,0 +1,115 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#include "resindex.h"
+
+#include <errno.h>
+#include <string.h>
+
+static void put32(unsigned char* p, uint32_t value) {
+    int i;
+    for (i=0; i < 4; i++) {
+        p[i] = (unsigned char) (value >> (i * 8));
+    }
+}
+
+static uint32_t get32(const unsigned char* p) {
+    uint32_t value = 0;
+    int i;
+    for (i=3; i >= 0; i--) {
+        value = (value << 8) | p[i];
+    }
+    return value;
+}
+
+static void put64(unsigned char* p, uint64_t value) {
+    int i;
+    for (i=0; i < 8; i++) {
+        p[i] = (unsigned char) (value >> (i * 8));
+    }
+}
+
+bool resindex_write_header(FILE* fp, uint32_t version, uint32_t flags) {
+    unsigned char header[16];
+    memcpy(header, RESINDEX_MAGIC, 4);
+    put32(header + 4, version);
+    put32(header + 8, flags);
+    put32(header + 12, 0);
+    return fwrite(header, 1, sizeof(header), fp) == sizeof(header);
+}
+
+bool resindex_read_header(FILE* fp, uint32_t* outVersion, uint32_t* outFlags) {
+    unsigned char header[16];
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header)) {
+        if (!ferror(fp)) {
+            errno = EINVAL;
+        }
+        return false;
+    }
+    if (memcmp(header, RESINDEX_MAGIC, 4) != 0) {
+        errno = EINVAL;
+        return false;
+    }
+    uint32_t version = get32(header + 4);
+    if (version < 1 || version > RESINDEX_VERSION) {
+        errno = EPROTONOSUPPORT;
+        return false;
+    }
+    *outVersion = version;
+    *outFlags = get32(header + 8);
+    return true;
+}
+
+bool resindex_write_record(FILE* fp, const resindex_record_t* record) {
+    unsigned char data[32];
+    put64(data, record->start);
+    put64(data + 8, record->end);
+    put64(data + 16, record->hash);
+    put32(data + 24, record->flags);
+    put32(data + 28, record->hitCount);
+    if (fwrite(data, 1, sizeof(data), fp) != sizeof(data)) {
+        return false;
+    }
+
+    uint32_t i;
+    for (i=0; i < record->hitCount; i++) {
+        unsigned char hit[12];
+        put32(hit, record->hits[i].term);
+        put64(hit + 4, record->hits[i].offset);
+        if (fwrite(hit, 1, sizeof(hit), fp) != sizeof(hit)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool resindex_write_file(FILE* fp, const char* path, uint64_t size) {
+    size_t length = strlen(path);
+    unsigned char data[32];
+    put64(data, 0);
+    put64(data + 8, size);
+    put64(data + 16, 0);
+    put32(data + 24, RESINDEX_FILE);
+    put32(data + 28, length);
+    if (fwrite(data, 1, sizeof(data), fp) != sizeof(data)) {
+        return false;
+    }
+    return fwrite(path, 1, length, fp) == length;
+}
@@ -0,0 +1,124 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef RESINDEX_H__
+#define RESINDEX_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stdio.h>
+
+    #include "matcher.h"
+
+    /**
+     * The result index is a compact binary description of the accepted
+     * chunks. Downstream tools can use it to read only the ranges they
+     * are interested in from the original dump file instead of parsing
+     * the text output. All integers are stored little-endian.
+     *
+     *     header  (16 bytes)
+     *         char[4]   magic "DFIX"
+     *         uint32    version (RESINDEX_VERSION)
+     *         uint32    header flags (RESINDEX_HAS_HASH, RESINDEX_HAS_FILES)
+     *         uint32    reserved, zero
+     *
+     *     record  (32 bytes + 12 bytes per hit)
+     *         uint64    start offset of the chunk in the input file
+     *         uint64    end offset of the chunk (exclusive)
+     *         uint64    content hash or zero
+     *         uint32    record flags (RESINDEX_DUPLICATE)
+     *         uint32    number of hits
+     *         hits:
+     *             uint32    search term index
+     *             uint64    offset of the first occurence of the term
+     *
+     * If several input files are scanned, the records of every file are
+     * preceded by a file record that has the RESINDEX_FILE flag set. Its
+     * end offset is the size of the file and instead of hits, the path
+     * of the file follows, with the number of hits being its length.
+     *
+     * Version 1 indexes have neither file records nor record flags.
+     * Version 2 is written if either of them can occur, so readers of
+     * version 1 reject these indexes instead of misreading them.
+     */
+
+    #define RESINDEX_MAGIC "DFIX"
+    #define RESINDEX_VERSION 2
+
+    /**
+     * Header flag that is set if the records contain the hash64() of
+     * the chunk contents.
+     */
+    #define RESINDEX_HAS_HASH 0x1
+
+    /**
+     * Header flag that is set if the index contains file records.
+     */
+    #define RESINDEX_HAS_FILES 0x2
+
+    /**
+     * Record flag that is set if deduplication is enabled and the same
+     * contents were already reported by a previous record.
+     */
+    #define RESINDEX_DUPLICATE 0x1
+
+    /**
+     * Record flag of the records that start the results of a file.
+     */
+    #define RESINDEX_FILE 0x2
+
+    struct resindex_record {
+        uint64_t start;
+        uint64_t end;
+        uint64_t hash;
+        uint32_t flags;
+        uint32_t hitCount;
+        const matcher_hit_t* hits;
+    };
+
+    typedef struct resindex_record resindex_record_t;
+
+    /**
+     * Write the index header with *version* to the file. Returns false
+     * if writing failed.
+     */
+    bool resindex_write_header(FILE* fp, uint32_t version, uint32_t flags);
+
+    /**
+     * Read the index header from the file and assign its version and
+     * flags. Returns false if it could not be read, *errno* is EINVAL
+     * if the file is not an index and EPROTONOSUPPORT if its version is
+     * not known.
+     */
+    bool resindex_read_header(FILE* fp, uint32_t* outVersion, uint32_t* outFlags);
+
+    /**
+     * Write a single record including its hits to the file. Returns
+     * false if writing failed.
+     */
+    bool resindex_write_record(FILE* fp, const resindex_record_t* record);
+
+    /**
+     * Write a file record for the file at *path* of *size* bytes.
+     * Returns false if writing failed.
+     */
+    bool resindex_write_file(FILE* fp, const char* path, uint64_t size);
+
+#endif /* RESINDEX_H__ */
@@ -0,0 +1,212 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#define _FILE_OFFSET_BITS 64
+
+#include "spool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+struct spool_record {
+    uint64_t offset;
+    uint64_t start;
+    uint64_t end;
+    uint64_t longestRun;
+    uint64_t dataOffset;
+    uint64_t length;
+    size_t firstHit;
+    size_t hitCount;
+};
+
+struct spool {
+    struct spool_record* records;
+    size_t count;
+    size_t capacity;
+
+    dumpfilter_hit_t* hits;
+    size_t hitCount;
+    size_t hitCapacity;
+
+    // The chunk data starts in memory and continues in a temporary
+    // file once the memory part is full.
+    char* memory;
+    uint64_t memorySize;
+    uint64_t memoryCapacity;
+    FILE* file;
+    uint64_t fileSize;
+
+    // Chunk data of the last `spool_get()` that was read from the file.
+    char* buffer;
+    uint64_t bufferSize;
+};
+
+spool_t* spool_alloc(void) {
+    spool_t* spool = allocate(sizeof(spool_t));
+    if (!spool) {
+        return NULL;
+    }
+    memset(spool, 0, sizeof(spool_t));
+    return spool;
+}
+
+void spool_free(spool_t* spool) {
+    if (spool->records) {
+        deallocate(spool->records);
+    }
+    if (spool->hits) {
+        deallocate(spool->hits);
+    }
+    if (spool->memory) {
+        deallocate(spool->memory);
+    }
+    if (spool->buffer) {
+        deallocate(spool->buffer);
+    }
+    if (spool->file) {
+        fclose(spool->file);
+    }
+    deallocate(spool);
+}
+
+static bool spool_write(spool_t* spool, const char* data, uint64_t length,
+                        uint64_t* dataOffset) {
+    if (!spool->file && spool->memorySize + length <= SPOOL_MEMORY_SIZE) {
+        if (spool->memorySize + length > spool->memoryCapacity) {
+            uint64_t capacity = spool->memoryCapacity ? spool->memoryCapacity : 4096;
+            while (capacity < spool->memorySize + length) {
+                capacity *= 2;
+            }
+            char* memory = reallocate(spool->memory, capacity);
+            if (!memory) {
+                return false;
+            }
+            spool->memory = memory;
+            spool->memoryCapacity = capacity;
+        }
+        memcpy(spool->memory + spool->memorySize, data, length);
+        *dataOffset = spool->memorySize;
+        spool->memorySize += length;
+        return true;
+    }
+
+    if (!spool->file) {
+        spool->file = tmpfile();
+        if (!spool->file) {
+            return false;
+        }
+    }
+    if (length > 0 && fwrite(data, length, 1, spool->file) != 1) {
+        return false;
+    }
+    *dataOffset = spool->memorySize + spool->fileSize;
+    spool->fileSize += length;
+    return true;
+}
+
+bool spool_add(spool_t* spool, const dumpfilter_match_t* match) {
+    if (spool->count == spool->capacity) {
+        size_t capacity = spool->capacity ? spool->capacity * 2 : 64;
+        struct spool_record* records = reallocate(spool->records,
+                sizeof(struct spool_record) * capacity);
+        if (!records) {
+            return false;
+        }
+        spool->records = records;
+        spool->capacity = capacity;
+    }
+    if (spool->hitCount + match->hitCount > spool->hitCapacity) {
+        size_t capacity = spool->hitCapacity ? spool->hitCapacity : 64;
+        while (capacity < spool->hitCount + match->hitCount) {
+            capacity *= 2;
+        }
+        dumpfilter_hit_t* hits = reallocate(spool->hits,
+                sizeof(dumpfilter_hit_t) * capacity);
+        if (!hits) {
+            return false;
+        }
+        spool->hits = hits;
+        spool->hitCapacity = capacity;
+    }
+
+    struct spool_record* record = &spool->records[spool->count];
+    if (!spool_write(spool, match->data, match->length, &record->dataOffset)) {
+        return false;
+    }
+    record->offset = match->offset;
+    record->start = match->start;
+    record->end = match->end;
+    record->longestRun = match->longestRun;
+    record->length = match->length;
+    record->firstHit = spool->hitCount;
+    record->hitCount = match->hitCount;
+    memcpy(spool->hits + spool->hitCount, match->hits,
+           sizeof(dumpfilter_hit_t) * match->hitCount);
+    spool->hitCount += match->hitCount;
+    spool->count++;
+    return true;
+}
+
+size_t spool_count(const spool_t* spool) {
+    return spool->count;
+}
+
+uint64_t spool_offset(const spool_t* spool, size_t index) {
+    return spool->records[index].offset;
+}
+
+bool spool_get(spool_t* spool, size_t index, dumpfilter_match_t* match) {
+    const struct spool_record* record = &spool->records[index];
+    match->offset = record->offset;
+    match->start = record->start;
+    match->end = record->end;
+    match->longestRun = record->longestRun;
+    match->length = record->length;
+    match->hits = spool->hits + record->firstHit;
+    match->hitCount = record->hitCount;
+
+    if (record->dataOffset + record->length <= spool->memorySize) {
+        match->data = spool->memory ? spool->memory + record->dataOffset : "";
+        return true;
+    }
+
+    if (record->length > spool->bufferSize || !spool->buffer) {
+        if (spool->buffer) {
+            deallocate(spool->buffer);
+        }
+        spool->buffer = allocate(record->length + 1);
+        if (!spool->buffer) {
+            spool->bufferSize = 0;
+            return false;
+        }
+        spool->bufferSize = record->length;
+    }
+    off_t position = record->dataOffset - spool->memorySize;
+    if (fflush(spool->file) != 0 || fseeko(spool->file, position, SEEK_SET) != 0) {
+        return false;
+    }
+    if (record->length > 0 &&
+            fread(spool->buffer, record->length, 1, spool->file) != 1) {
+        return false;
+    }
+    match->data = spool->buffer;
+    return true;
+}
@@ -0,0 +1,78 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef SPOOL_H__
+#define SPOOL_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+
+    #include "memory.h"
+    #include "dumpfilter.h"
+
+    /**
+     * The number of bytes of chunk data a spool keeps in memory before
+     * it moves to a temporary file.
+     */
+    #define SPOOL_MEMORY_SIZE (4 * 1024 * 1024)
+
+    /**
+     * A sequence of matches that is collected by one thread and
+     * replayed later by another one, so results that are found in
+     * parallel can be written in a fixed order.
+     */
+    struct spool;
+
+    typedef struct spool spool_t;
+
+    /**
+     * Allocate an empty spool. Returns NULL on failure.
+     */
+    spool_t* spool_alloc(void);
+
+    /**
+     * Free the spool and remove its temporary file.
+     */
+    void spool_free(spool_t* spool);
+
+    /**
+     * Append a copy of *match*. Returns false on failure.
+     */
+    bool spool_add(spool_t* spool, const dumpfilter_match_t* match);
+
+    /**
+     * Returns the number of matches in the spool.
+     */
+    size_t spool_count(const spool_t* spool);
+
+    /**
+     * Returns the offset of the match at *index* without reading its
+     * data.
+     */
+    uint64_t spool_offset(const spool_t* spool, size_t index);
+
+    /**
+     * Fill *match* with the match at *index*. The data is valid until
+     * the next call. Returns false if it could not be read.
+     */
+    bool spool_get(spool_t* spool, size_t index, dumpfilter_match_t* match);
+
+#endif /* SPOOL_H__ */
@@ -0,0 +1,366 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#include "uring.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+enum {
+    URING_IDLE,
+    URING_READING,
+    URING_DONE
+};
+
+/**
+ * A block buffer and the read into it. *size* is the number of bytes
+ * wanted from *offset*, *length* the number requested (rounded up to
+ * the alignment).
+ */
+struct uring_block {
+    char* data;
+    struct iovec iov;
+    uint64_t offset;
+    size_t size;
+    size_t length;
+    size_t filled;
+    size_t consumed;
+    int state;
+    int error;
+};
+
+struct uring {
+    int ring;
+    int fd;
+
+    // The rings shared with the kernel.
+    void* sqMap;
+    size_t sqMapSize;
+    void* cqMap;
+    size_t cqMapSize;
+    struct io_uring_sqe* sqes;
+    size_t sqesSize;
+    unsigned* sqTail;
+    unsigned* sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned* cqMask;
+    struct io_uring_cqe* cqes;
+
+    struct uring_block* blocks;
+    unsigned depth;
+    size_t blockSize;
+    size_t align;
+
+    // The offset of the next block to read, the end of the range, the
+    // sequence number of the block to return next, the number of reads
+    // in flight and of those not yet passed to the kernel.
+    uint64_t next;
+    uint64_t end;
+    uint64_t seq;
+    unsigned inflight;
+    unsigned unsubmitted;
+};
+
+/**
+ * Put the read of the unfilled part of *block* in the submission queue.
+ */
+static void uring_queue(uring_t* uring, struct uring_block* block) {
+    unsigned tail = *uring->sqTail;
+    unsigned index = tail & *uring->sqMask;
+    struct io_uring_sqe* sqe = &uring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    block->iov.iov_base = block->data + block->filled;
+    block->iov.iov_len = block->length - block->filled;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = uring->fd;
+    sqe->addr = (uint64_t) (uintptr_t) &block->iov;
+    sqe->len = 1;
+    sqe->off = block->offset + block->filled;
+    sqe->user_data = block - uring->blocks;
+    uring->sqArray[index] = index;
+    __atomic_store_n(uring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    block->state = URING_READING;
+    uring->inflight++;
+    uring->unsubmitted++;
+}
+
+/**
+ * Start reading the next block of the range into *block*.
+ */
+static void uring_queue_next(uring_t* uring, struct uring_block* block) {
+    block->offset = uring->next;
+    block->size = uring->blockSize;
+    if (uring->end - block->offset < block->size) {
+        block->size = uring->end - block->offset;
+    }
+    block->length = block->size + (uring->align - block->size % uring->align) % uring->align;
+    block->filled = 0;
+    block->consumed = 0;
+    block->error = 0;
+    uring->next += block->size;
+    uring_queue(uring, block);
+}
+
+/**
+ * Pass the queued reads to the kernel and, if *wait* is true, wait for
+ * at least one completion. Returns false on failure.
+ */
+static bool uring_enter(uring_t* uring, bool wait) {
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int result = syscall(__NR_io_uring_enter, uring->ring, uring->unsubmitted,
+                         wait ? 1 : 0, flags, NULL, 0);
+    if (result < 0) {
+        return errno == EINTR || errno == EAGAIN || errno == EBUSY;
+    }
+    uring->unsubmitted -= result;
+    return true;
+}
+
+/**
+ * Wait for completed reads and update their blocks. Reads that came
+ * short before the end of their block are continued.
+ */
+static bool uring_wait(uring_t* uring) {
+    unsigned head = *uring->cqHead;
+    if (head == __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE)) {
+        return uring_enter(uring, true);
+    }
+    do {
+        struct io_uring_cqe* cqe = &uring->cqes[head & *uring->cqMask];
+        struct uring_block* block = &uring->blocks[cqe->user_data];
+        int result = cqe->res;
+        head++;
+        uring->inflight--;
+        if (result == -EINTR || result == -EAGAIN) {
+            uring_queue(uring, block);
+        }
+        else if (result < 0) {
+            block->error = -result;
+            block->state = URING_DONE;
+        }
+        else {
+            block->filled += result;
+            if (result > 0 && block->filled < block->size) {
+                uring_queue(uring, block);
+            }
+            else {
+                // The end of the range may be within the last aligned
+                // read.
+                if (block->filled > block->size) {
+                    block->filled = block->size;
+                }
+                block->state = URING_DONE;
+            }
+        }
+    } while (head != __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE));
+    __atomic_store_n(uring->cqHead, head, __ATOMIC_RELEASE);
+    return uring->unsubmitted == 0 || uring_enter(uring, false);
+}
+
+uring_t* uring_start(int fd, uint64_t start, uint64_t end,
+                     size_t blockSize, size_t align, unsigned depth) {
+    #ifndef __NR_io_uring_setup
+        errno = ENOSYS;
+        return NULL;
+    #else
+    if (align == 0) {
+        align = 1;
+    }
+    if (depth == 0 || blockSize == 0 || blockSize % align != 0 || end <= start) {
+        errno = EINVAL;
+        return NULL;
+    }
+    uring_t* uring = allocate(sizeof(uring_t));
+    if (!uring) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(uring, 0, sizeof(uring_t));
+    uring->fd = fd;
+    uring->depth = depth;
+    uring->blockSize = blockSize;
+    uring->align = align;
+    uring->sqMap = MAP_FAILED;
+    uring->cqMap = MAP_FAILED;
+    uring->sqes = MAP_FAILED;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    uring->ring = syscall(__NR_io_uring_setup, depth, &params);
+    if (uring->ring < 0) {
+        int error = errno;
+        deallocate(uring);
+        errno = error;
+        return NULL;
+    }
+
+    // Map the rings, which can share one mapping with newer kernels.
+    uring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && uring->cqMapSize > uring->sqMapSize) {
+        uring->sqMapSize = uring->cqMapSize;
+    }
+    uring->sqMap = mmap(NULL, uring->sqMapSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, uring->ring, IORING_OFF_SQ_RING);
+    if (uring->sqMap != MAP_FAILED) {
+        uring->cqMap = single ? uring->sqMap :
+                mmap(NULL, uring->cqMapSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, uring->ring, IORING_OFF_CQ_RING);
+    }
+    uring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (uring->cqMap != MAP_FAILED) {
+        uring->sqes = mmap(NULL, uring->sqesSize, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, uring->ring, IORING_OFF_SQES);
+    }
+    if (uring->sqes == MAP_FAILED) {
+        int error = errno;
+        uring_stop(uring);
+        errno = error;
+        return NULL;
+    }
+    char* sq = uring->sqMap;
+    char* cq = uring->cqMap;
+    uring->sqTail = (unsigned*) (sq + params.sq_off.tail);
+    uring->sqMask = (unsigned*) (sq + params.sq_off.ring_mask);
+    uring->sqArray = (unsigned*) (sq + params.sq_off.array);
+    uring->cqHead = (unsigned*) (cq + params.cq_off.head);
+    uring->cqTail = (unsigned*) (cq + params.cq_off.tail);
+    uring->cqMask = (unsigned*) (cq + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe*) (cq + params.cq_off.cqes);
+
+    uring->blocks = allocate(sizeof(struct uring_block) * depth);
+    if (!uring->blocks) {
+        uring_stop(uring);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(uring->blocks, 0, sizeof(struct uring_block) * depth);
+    unsigned i;
+    for (i=0; i < depth; i++) {
+        uring->blocks[i].data = allocate_pages(blockSize);
+        if (!uring->blocks[i].data) {
+            uring_stop(uring);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    // Direct reads start at the aligned offset before *start*.
+    uring->next = start - start % align;
+    uring->end = end;
+    for (i=0; i < depth && uring->next < uring->end; i++) {
+        uring_queue_next(uring, &uring->blocks[i]);
+    }
+    uring->blocks[0].consumed = start - uring->blocks[0].offset;
+    if (!uring_enter(uring, false)) {
+        int error = errno;
+        uring_stop(uring);
+        errno = error;
+        return NULL;
+    }
+    return uring;
+    #endif
+}
+
+ssize_t uring_read(uring_t* uring, void* buffer, size_t size) {
+    size_t filled = 0;
+    while (filled < size) {
+        struct uring_block* block = &uring->blocks[uring->seq % uring->depth];
+        if (block->state == URING_IDLE) {
+            break;
+        }
+        while (block->state == URING_READING) {
+            if (!uring_wait(uring)) {
+                return -1;
+            }
+        }
+        if (block->error) {
+            errno = block->error;
+            return -1;
+        }
+
+        size_t count = block->filled > block->consumed ? block->filled - block->consumed : 0;
+        if (count > size - filled) {
+            count = size - filled;
+        }
+        memcpy((char*) buffer + filled, block->data + block->consumed, count);
+        block->consumed += count;
+        filled += count;
+        if (block->consumed < block->filled) {
+            continue;
+        }
+
+        // The block is used up. If it came short, the file is shorter
+        // than expected and the blocks after it are empty.
+        if (block->filled < block->size) {
+            uring->end = block->offset + block->filled;
+        }
+        block->state = URING_IDLE;
+        uring->seq++;
+        if (uring->next < uring->end) {
+            uring_queue_next(uring, block);
+        }
+    }
+    if (uring->unsubmitted > 0 && !uring_enter(uring, false)) {
+        return -1;
+    }
+    return filled;
+}
+
+void uring_stop(uring_t* uring) {
+    if (!uring) {
+        return;
+    }
+    // The kernel may still write to the buffers.
+    while (uring->inflight > 0 && uring->blocks) {
+        if (!uring_wait(uring)) {
+            break;
+        }
+    }
+    if (uring->blocks) {
+        unsigned i;
+        for (i=0; i < uring->depth; i++) {
+            deallocate_pages(uring->blocks[i].data, uring->blockSize);
+        }
+        deallocate(uring->blocks);
+    }
+    if (uring->sqes != MAP_FAILED) {
+        munmap(uring->sqes, uring->sqesSize);
+    }
+    if (uring->cqMap != MAP_FAILED && uring->cqMap != uring->sqMap) {
+        munmap(uring->cqMap, uring->cqMapSize);
+    }
+    if (uring->sqMap != MAP_FAILED) {
+        munmap(uring->sqMap, uring->sqMapSize);
+    }
+    close(uring->ring);
+    deallocate(uring);
+}
@@ -0,0 +1,63 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+#ifndef URING_H__
+#define URING_H__
+
+    #include <stdbool.h>
+    #include <stdint.h>
+    #include <stddef.h>
+    #include <sys/types.h>
+
+    #include "memory.h"
+
+    /**
+     * Reads a range of a file with io_uring. Up to *depth* reads of one
+     * block each are in flight at any time, so the device works on the
+     * next blocks while the current one is scanned. The blocks are
+     * returned in the order of the file. The buffers are aligned to the
+     * page size, so the reads can use O_DIRECT.
+     */
+    struct uring;
+
+    typedef struct uring uring_t;
+
+    /**
+     * Start reading *fd* from *start* to *end* in blocks of *blockSize*
+     * bytes. With direct I/O, the blocks are read at offsets aligned to
+     * *align* bytes (*blockSize* must be a multiple of it). Returns NULL
+     * if io_uring is not available, *errno* is set accordingly.
+     */
+    uring_t* uring_start(int fd, uint64_t start, uint64_t end,
+                         size_t blockSize, size_t align, unsigned depth);
+
+    /**
+     * Read up to *size* bytes. Less than *size* bytes are only returned
+     * at the end of the range. Returns -1 on error.
+     */
+    ssize_t uring_read(uring_t* uring, void* buffer, size_t size);
+
+    /**
+     * Wait for the reads in flight and free the reader. The file
+     * descriptor is not closed.
+     */
+    void uring_stop(uring_t* uring);
+
+#endif /* URING_H__ */
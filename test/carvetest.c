@@ -0,0 +1,270 @@
+/* Copyright (c) 2014  Niklas Rosenstein
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE. */
+
+/* Checks of the file carving on generated data.
+ *
+ * A JPEG image with an EXIF thumbnail, whose own start and end of image
+ * markers are inside the APP1 segment of the image, a second image and
+ * two images with a wrong segment length are fed to the carver in blocks
+ * of different sizes. Every image has to be reported once and extracted
+ * completely, the damaged ones up to their first end of image marker:
+ *
+ *     dumpfilter-test
+ *
+ * The exit code is 1 if a check failed.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../src/carve.h"
+
+#define TEST_MAX_HITS 16
+
+/**
+ * The hits of a run of the carver.
+ */
+struct hits {
+    uint64_t offsets[TEST_MAX_HITS];
+    int types[TEST_MAX_HITS];
+    size_t count;
+};
+
+static int failures = 0;
+
+static void check(bool condition, const char* what, size_t blockSize) {
+    if (!condition) {
+        printf("FAIL: %s (blocks of %zu bytes)\n", what, blockSize);
+        failures++;
+    }
+}
+
+static bool collect_hit(void* user, const carve_hit_t* hit) {
+    struct hits* hits = user;
+    if (hits->count < TEST_MAX_HITS) {
+        hits->offsets[hits->count] = hit->offset;
+        hits->types[hits->count] = hit->type;
+    }
+    hits->count++;
+    return true;
+}
+
+static size_t put(unsigned char* data, size_t size, const void* bytes, size_t length) {
+    memcpy(data + size, bytes, length);
+    return size + length;
+}
+
+/**
+ * Append a segment with *marker* and *length* bytes of contents.
+ */
+static size_t put_segment(unsigned char* data, size_t size, unsigned char marker,
+                          const unsigned char* contents, size_t length) {
+    data[size++] = 0xFF;
+    data[size++] = marker;
+    data[size++] = (length + 2) >> 8;
+    data[size++] = (length + 2) & 0xFF;
+    return put(data, size, contents, length);
+}
+
+/**
+ * Append entropy-coded data that contains stuffed FF bytes and a
+ * restart marker.
+ */
+static size_t put_scan(unsigned char* data, size_t size, size_t length) {
+    static const unsigned char header[10] = {3, 1, 0, 2, 0x11, 3, 0x11, 0, 63, 0};
+    size = put_segment(data, size, 0xDA, header, sizeof(header));
+    size_t i;
+    for (i=0; i < length; i++) {
+        unsigned char byte = (i * 37 + 11) & 0xFF;
+        data[size++] = byte;
+        if (byte == 0xFF) {
+            data[size++] = 0x00;
+        }
+        if (i == length / 2) {
+            data[size++] = 0xFF;
+            data[size++] = 0xD0;
+        }
+    }
+    return size;
+}
+
+/**
+ * Append a JPEG image, with an EXIF thumbnail if *thumbnail* is true.
+ * Returns the new size.
+ */
+static size_t put_jpeg(unsigned char* data, size_t size, bool thumbnail) {
+    static const unsigned char soi[2] = {0xFF, 0xD8};
+    static const unsigned char eoi[2] = {0xFF, 0xD9};
+    unsigned char contents[1024];
+    memset(contents, 0x10, sizeof(contents));
+    size = put(data, size, soi, sizeof(soi));
+
+    if (thumbnail) {
+        // The thumbnail is a complete image in the TIFF data.
+        size_t length = put(contents, 0, "Exif\0\0II*\0\x08\0\0\0", 14);
+        memset(contents + length, 0, 16);
+        length += 16;
+        length = put(contents, length, soi, sizeof(soi));
+        length = put_segment(contents, length, 0xDB, contents + 200, 65);
+        length = put_scan(contents, length, 120);
+        length = put(contents, length, eoi, sizeof(eoi));
+        memset(contents + length, 0, 8);
+        size = put_segment(data, size, 0xE1, contents, length + 8);
+    }
+    else {
+        size = put_segment(data, size, 0xE0, (const unsigned char*) "JFIF\0\1\1\0\0\1\0\1\0\0", 14);
+    }
+    memset(contents, 0x10, 256);
+    size = put_segment(data, size, 0xDB, contents, 65);
+    size = put_segment(data, size, 0xC2, contents, 15);
+    size = put_segment(data, size, 0xC4, contents, 29);
+    size = put_scan(data, size, 300);
+
+    // A progressive image has more scans after the first one.
+    size = put_segment(data, size, 0xC4, contents, 29);
+    size = put_scan(data, size, 200);
+    return put(data, size, eoi, sizeof(eoi));
+}
+
+/**
+ * Append an image whose first segment has the wrong *length*, so it can
+ * not be parsed, followed by an end of image marker.
+ */
+static size_t put_damaged(unsigned char* data, size_t size, unsigned int length) {
+    static const unsigned char header[6] = {0xFF, 0xD8, 0xFF, 0xE0};
+    unsigned char bytes[sizeof(header)];
+    memcpy(bytes, header, sizeof(header));
+    bytes[4] = length >> 8;
+    bytes[5] = length & 0xFF;
+    size = put(data, size, bytes, sizeof(bytes));
+    memset(data + size, 0x20, 100);
+    size += 100;
+    data[size++] = 0xFF;
+    data[size++] = 0xD9;
+    return size;
+}
+
+/**
+ * Returns true if the file at *path* contains exactly the *size* bytes
+ * of *expected*.
+ */
+static bool file_equals(const char* path, const unsigned char* expected, size_t size) {
+    FILE* fp = fopen(path, "rb");
+    if (!fp) {
+        return false;
+    }
+    static unsigned char contents[8192];
+    size_t length = fread(contents, 1, sizeof(contents), fp);
+    fclose(fp);
+    return length == size && memcmp(contents, expected, size) == 0;
+}
+
+/**
+ * Feed *data* in blocks of *blockSize* and check the hits at *offsets*
+ * and, if *directory* is not NULL, the extracted images of *sizes*.
+ */
+static void run(const unsigned char* data, size_t size, size_t blockSize,
+                const char* directory, const uint64_t* offsets, const size_t* sizes,
+                size_t count) {
+    struct hits hits;
+    memset(&hits, 0, sizeof(hits));
+    carve_t* carve = carve_alloc(directory, 0, collect_hit, &hits);
+    if (!carve) {
+        check(false, "carve_alloc()", blockSize);
+        return;
+    }
+    carve_reset(carve, 0, NULL);
+    size_t i;
+    bool result = true;
+    for (i=0; i < size && result; i += blockSize) {
+        result = carve_feed(carve, data + i, size - i < blockSize ? size - i : blockSize);
+    }
+    result = result && carve_finish(carve);
+    carve_free(carve);
+    check(result, "feeding the carver", blockSize);
+
+    check(hits.count == count, "one hit per image", blockSize);
+    for (i=0; i < count && i < hits.count; i++) {
+        check(hits.offsets[i] == offsets[i] && hits.types[i] == CARVE_JPEG,
+              "the offset of an image", blockSize);
+    }
+    if (!directory) {
+        return;
+    }
+    for (i=0; i < count; i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%llu.jpg", directory, (unsigned long long) offsets[i]);
+        check(file_equals(path, data + offsets[i], sizes[i]), "an extracted image", blockSize);
+        unlink(path);
+    }
+}
+
+int main(void) {
+    static unsigned char data[16384];
+    uint64_t offsets[4];
+    size_t sizes[4];
+    size_t size = 0;
+    memset(data, 0x41, sizeof(data));
+
+    size += 777;
+    offsets[0] = size;
+    size = put_jpeg(data, size, true);
+    sizes[0] = size - offsets[0];
+    size += 300;
+    offsets[1] = size;
+    size = put_jpeg(data, size, false);
+    sizes[1] = size - offsets[1];
+
+    // The parser fails after the end of the first damaged image, and
+    // before the end of the second one.
+    size += 300;
+    offsets[2] = size;
+    size = put_damaged(data, size, 256);
+    sizes[2] = size - offsets[2];
+    size += 300;
+    offsets[3] = size;
+    size = put_damaged(data, size, 16);
+    sizes[3] = size - offsets[3];
+    size += 1000;
+
+    char directory[] = "/tmp/dumpfilter-test-XXXXXX";
+    if (!mkdtemp(directory)) {
+        printf("FAIL: could not create %s\n", directory);
+        return 1;
+    }
+    static const size_t blockSizes[] = {1, 2, 7, 31, 32, 33, 500, 16384};
+    size_t i;
+    for (i=0; i < sizeof(blockSizes) / sizeof(blockSizes[0]); i++) {
+        run(data, size, blockSizes[i], NULL, offsets, sizes, 4);
+        run(data, size, blockSizes[i], directory, offsets, sizes, 4);
+    }
+    rmdir(directory);
+
+    if (failures > 0) {
+        printf("%d checks failed.\n", failures);
+        return 1;
+    }
+    printf("All checks passed, the image with a thumbnail has %zu bytes.\n", sizes[0]);
+    return 0;
+}